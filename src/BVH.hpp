@@ -1,80 +1,157 @@
 #pragma once
 
+#include <algorithm>
+
 #include "global.hpp"
-#include "./obj/OBJ.hpp"
 
 
 
 namespace BVH{
     using namespace Eigen;
-    class BBox{
-    public:
-        Vector3f low_bound;
-        Vector3f high_bound;
-    };
+    class BBox;
+    class Node;
+    class Tree;
+}
 
-    class Node{
-    public:
-        BBox bbox;
-        Node* left;
-        Node* right;
-        Obj::Triangle* triangle;
-        /*pointer allocated on the heap*/
-        Node(std::vector<Obj::Triangle*> triangles){
-            if(triangles.size() == 1){
-                triangle = triangles[0];
-                bbox.low_bound = min(triangle->A->position,triangle->B->position,triangle->C->position);
-                bbox.high_bound = max(triangle->A->position,triangle->B->position,triangle->C->position);
-                left = nullptr;
-                right = nullptr;
-            }
-            else{
-                float min_x = MAX_F,max_x = MIN_F,min_y = MAX_F,max_y = MIN_F,min_z = MAX_F,max_z = MIN_F;
-                for(const Obj::Triangle* t : triangles){
-                    Eigen::Vector3f A_position = t->A->position;
-                    minmaxize(min_x,max_x,A_position.x());
-                    minmaxize(min_y,max_y,A_position.y());
-                    minmaxize(min_z,max_z,A_position.z());
-                }
-                float x_diff = max_x - min_x;
-                float y_diff = max_y - min_y;
-                float z_diff = max_z - min_z;
-                if(x_diff > y_diff && x_diff > z_diff){
-                    std::sort(triangles.begin(),triangles.end(),[](Obj::Triangle* a,Obj::Triangle* b){
-                        return a->A->position.x() < b->A->position.x();
-                    });
-                }
-                else if(y_diff > x_diff && y_diff > z_diff){
-                    std::sort(triangles.begin(),triangles.end(),[](Obj::Triangle* a,Obj::Triangle* b){
-                        return a->A->position.y() < b->A->position.y();
-                    });
-                }
-                else if(z_diff > x_diff && z_diff > y_diff){
-                    std::sort(triangles.begin(),triangles.end(),[](Obj::Triangle* a,Obj::Triangle* b){
-                        return a->A->position.y() < b->A->position.y();
-                    });
-                }
-                std::vector<Obj::Triangle*>::iterator middle = triangles.begin() + triangles.size() / 2;
-                std::vector<Obj::Triangle*> first_half(triangles.begin(), middle);
-                std::vector<Obj::Triangle*> second_half(middle, triangles.end());
+class BVH::BBox{
+public:
+    Vector3f low_bound;
+    Vector3f high_bound;
 
-                left = new Node(first_half);
-                right = new Node(second_half);
-                bbox.low_bound = min(left->bbox.low_bound,right->bbox.low_bound);
-                bbox.high_bound = max(left->bbox.high_bound,right->bbox.high_bound);
-                triangle = nullptr;
-            }
+    /*empty box, extend() with the first point sets both bounds*/
+    BBox(): low_bound(MAX_F, MAX_F, MAX_F), high_bound(-MAX_F, -MAX_F, -MAX_F){}
+    BBox(const Vector3f& low_bound, const Vector3f& high_bound): low_bound(low_bound), high_bound(high_bound){}
+
+    inline void extend(const Vector3f& point){
+        low_bound = low_bound.cwiseMin(point);
+        high_bound = high_bound.cwiseMax(point);
+    }
+    inline void extend(const BBox& other){
+        low_bound = low_bound.cwiseMin(other.low_bound);
+        high_bound = high_bound.cwiseMax(other.high_bound);
+    }
+    inline Vector3f center() const{
+        return (low_bound + high_bound) * 0.5f;
+    }
+    /*squared distance from `point` to the box, 0 inside*/
+    inline float distance2(const Vector3f& point) const{
+        return (point - point.cwiseMax(low_bound).cwiseMin(high_bound)).squaredNorm();
+    }
+    inline Vector3f corner(int c) const{
+        return Vector3f((c & 1) ? high_bound[0] : low_bound[0], (c & 2) ? high_bound[1] : low_bound[1], (c & 4) ? high_bound[2] : low_bound[2]);
+    }
+    /*bounds of the 8 corners moved by an affine `matrix`*/
+    inline BBox transformed(const Matrix4f& matrix) const{
+        BBox result;
+        for(int c = 0;c < 8;c++){
+            result.extend((matrix * corner(c).homogeneous()).head<3>());
+        }
+        return result;
+    }
+    /*smallest dot(corner, direction) over the corners of the box*/
+    inline float min_along(const Vector3f& direction) const{
+        return center().dot(direction) - 0.5f * (high_bound - low_bound).dot(direction.cwiseAbs());
+    }
+};
+
+/*left < 0 marks a leaf, covering Tree::order[first, first + count)*/
+class BVH::Node{
+public:
+    BBox bbox;
+    int left;
+    int right;
+    int first;
+    int count;
+};
+
+/*
+flat bounding volume hierarchy over primitive boxes, nodes[0] is the root
+primitives are split at the median centroid of the widest centroid axis until at most `leaf_size` remain,
+so every leaf is a spatially coherent cluster stored as a contiguous run of `order`
+*/
+class BVH::Tree{
+public:
+    std::vector<BVH::Node> nodes;
+    std::vector<int> order; // primitive indices grouped by leaf
+
+    void build(const std::vector<BVH::BBox>& boxes, const int leaf_size = 32){
+        nodes.clear();
+        order.resize(boxes.size());
+        for(int i = 0;i < (int)order.size();i++){
+            order[i] = i;
+        }
+        if(boxes.empty()){
+            return;
         }
-        ~Node(){
-            delete left;
-            delete right;
-            left = nullptr;
-            right = nullptr;
+        std::vector<Vector3f> centers(boxes.size());
+        for(int i = 0;i < (int)boxes.size();i++){
+            centers[i] = boxes[i].center();
         }
+        nodes.reserve(2 * (boxes.size() / (leaf_size > 1 ? leaf_size : 1)) + 1);
+        build_node(boxes, centers, 0, boxes.size(), leaf_size > 1 ? leaf_size : 1);
+    }
+    inline bool empty() const{
+        return nodes.empty();
+    }
 
-        Obj::Triangle* triangle_insert(Obj::Ray ray){
-            return NULL;
+    /*
+    visits the leaves in ascending `key(bbox)`-first order, the nearer child of every node is entered first
+    calls visit(first, count) with the range of `order` of each leaf
+    */
+    template<typename Key, typename Visit>
+    void traverse_ordered(Key&& key, Visit&& visit) const{
+        if(nodes.empty()){
+            return;
         }
+        std::vector<int> stack;
+        stack.push_back(0);
+        while(!stack.empty()){
+            const BVH::Node& node = nodes[stack.back()];
+            stack.pop_back();
+            if(node.left < 0){
+                visit(node.first, node.count);
+                continue;
+            }
+            if(key(nodes[node.left].bbox) <= key(nodes[node.right].bbox)){
+                stack.push_back(node.right);
+                stack.push_back(node.left);
+            }
+            else{
+                stack.push_back(node.left);
+                stack.push_back(node.right);
+            }
+        }
+    }
 
-    };
-}
+private:
+    int build_node(const std::vector<BVH::BBox>& boxes, const std::vector<Vector3f>& centers, const int begin, const int end, const int leaf_size){
+        const int index = nodes.size();
+        nodes.push_back(BVH::Node());
+        BVH::BBox bbox;
+        BVH::BBox center_bbox;
+        for(int i = begin;i < end;i++){
+            bbox.extend(boxes[order[i]]);
+            center_bbox.extend(centers[order[i]]);
+        }
+        Vector3f extent = center_bbox.high_bound - center_bbox.low_bound;
+        int axis = 0;
+        if(extent[1] > extent[axis]){
+            axis = 1;
+        }
+        if(extent[2] > extent[axis]){
+            axis = 2;
+        }
+        if(end - begin <= leaf_size || extent[axis] <= 0){
+            nodes[index] = { bbox, -1, -1, begin, end - begin };
+            return index;
+        }
+        const int middle = begin + (end - begin) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, [&](int a, int b){
+            return centers[a][axis] < centers[b][axis];
+        });
+        const int left = build_node(boxes, centers, begin, middle, leaf_size);
+        const int right = build_node(boxes, centers, middle, end, leaf_size);
+        nodes[index] = { bbox, left, right, begin, end - begin };
+        return index;
+    }
+};
@@ -167,6 +167,14 @@ public:
         return *this;
     }
 
+    /*perceived brightness, the gray value itself for black-white colors*/
+    inline float luma() const{
+        if(image_color == ImageColor::BLACKWHITE || image_color == ImageColor::BLACKWHITEALPHA){
+            return color[0];
+        }
+        return color[2] * 0.299f + color[1] * 0.587f + color[0] * 0.114f;
+    }
+
     inline void color_assign_fullcoloralpha(float* buff) const{
         if(this->image_color != ImageColor::FULLCOLORALPHA){
             throw Manga3DException("Color assignment unmatch, expect FULLCOLORALPHA, get " + imgcolor_2_string(image_color));
@@ -220,12 +228,12 @@ public:
         const Eigen::Vector3f& bc_coord){
 
         Raster::Color color = default_color;
-        if(obj->texture.has_value()){
+        if(obj->texture){
             float u, v;
             Eigen::Vector2f uv = triangle->get_uv_from_barycentric(bc_coord);
             u = uv[0];
             v = uv[1];
-            Eigen::Vector3f tex_color = obj->texture.value().bilinear_sampling(u, v);
+            Eigen::Vector3f tex_color = obj->texture->bilinear_sampling(u, v);
             switch(color.image_color){
             case Raster::Color::ImageColor::FULLCOLORALPHA:
                 color = Raster::Color(tex_color[0], tex_color[1], tex_color[2], 1);
@@ -0,0 +1,384 @@
+#include <iostream>
+#include <iomanip>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <sstream>
+#include <random>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <filesystem>
+
+#include "global.hpp"
+#include "./raster/Rasterizer.hpp"
+#include "./output/Output.hpp"
+
+/*
+stage microbenchmarks
+    bench [obj_file [tex_file]] [--reps n] [--min-ms t] [--threads n] [--filter text]
+every case runs once to warm up, then at least `reps` times and at least `min-ms` in total,
+the best and median run are reported with the throughput of the best one
+random inputs come from a fixed seed, so numbers are comparable between builds
+*/
+namespace Bench{
+    struct Work{
+        double amount;
+        std::string unit; // throughput is amount / second in this unit
+    };
+
+    struct Options{
+        int reps = 10;
+        double min_ms = 200;
+        std::string filter;
+    };
+
+    /*z-test only*/
+    class DepthShader: public Raster::Shader{
+    public:
+        bool shade(const Obj::ObjSet* obj,
+            const Obj::Triangle* triangle,
+            const Raster::ProjectedTriangle& projected,
+            const Eigen::Vector3f bc_coord,
+            const Raster::Color& fill_color,
+            float* z_p,
+            float* top_p,
+            const bool verbose){
+
+            float z = projected.get_z(bc_coord);
+            if(z > 0 || z < *z_p){
+                return false;
+            }
+            *z_p = z;
+            return true;
+        }
+    };
+
+    /*a point on a visible triangle, as handed to Shader::shade by Camera::paint*/
+    struct Fragment{
+        const Obj::Triangle* triangle;
+        Raster::ProjectedTriangle projected;
+        Eigen::Vector3f bc_coord;
+    };
+
+    inline std::string format_rate(double per_second, const std::string& unit){
+        const char* prefix[] = { "", "k", "M", "G" };
+        int p = 0;
+        while(per_second >= 1000 && p < 3){
+            per_second /= 1000;
+            p++;
+        }
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(per_second < 10 ? 2 : 1) << per_second << " " << prefix[p] << unit << "/s";
+        return text.str();
+    }
+
+    /*
+    times `body`, `setup` runs untimed before every call
+    */
+    inline void run(const Options& options, const std::string& name, const std::vector<Work>& work, std::function<void()> body, std::function<void()> setup = nullptr){
+        if(!options.filter.empty() && name.find(options.filter) == std::string::npos){
+            return;
+        }
+        auto timed = [&](){
+            if(setup){
+                setup();
+            }
+            auto t0 = std::chrono::steady_clock::now();
+            body();
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        };
+        timed();
+        std::vector<double> times;
+        double total = 0;
+        while((int)times.size() < options.reps || (total < options.min_ms && times.size() < 10000)){
+            times.push_back(timed());
+            total += times.back();
+        }
+        std::sort(times.begin(), times.end());
+        const double best = times.front();
+        const double median = times[times.size() / 2];
+
+        std::cout << std::left << std::setw(36) << name << std::right
+                  << std::setw(7) << times.size()
+                  << std::fixed << std::setprecision(3)
+                  << std::setw(12) << best << std::setw(12) << median << "  ";
+        for(int i = 0;i < (int)work.size();i++){
+            std::cout << (i ? ", " : "") << format_rate(best > 0 ? work[i].amount * 1000.0 / best : 0, work[i].unit);
+        }
+        std::cout << std::endl;
+    }
+}
+
+
+int main(int argc, char** argv){
+    std::string obj_path = "./model/monkey/monkey.obj";
+    std::string tex_path = "./model/monkey/color.png";
+    int positional = 0;
+    Bench::Options options;
+    for(int i = 1;i < argc;i++){
+        std::string arg = argv[i];
+        if(arg == "--reps" && i + 1 < argc){
+            options.reps = std::max(1, std::atoi(argv[++i]));
+        }
+        else if(arg == "--min-ms" && i + 1 < argc){
+            options.min_ms = std::atof(argv[++i]);
+        }
+        else if(arg == "--threads" && i + 1 < argc){
+            thread_count() = std::max(1, std::atoi(argv[++i]));
+        }
+        else if(arg == "--filter" && i + 1 < argc){
+            options.filter = argv[++i];
+        }
+        else if(positional == 0){
+            obj_path = arg;
+            tex_path = "";
+            positional++;
+        }
+        else if(positional == 1){
+            tex_path = arg;
+            positional++;
+        }
+        else{
+            std::cerr << "usage: bench [obj_file [tex_file]] [--reps n] [--min-ms t] [--threads n] [--filter text]" << std::endl;
+            return 2;
+        }
+    }
+
+    try{
+        const int w = 900;
+        const int h = 600;
+        const int fragment_count = 1 << 16;
+        const int line_count = 4096;
+        std::mt19937 rng(20240607);
+        std::uniform_real_distribution<float> unit(0, 1);
+
+        Raster::Color bg_color(1, 1, 1);
+        Raster::Color line_color(0, 0, 0);
+        Raster::Color fill_color(1, 1, 1);
+        Raster::Color light_color(1, 1, 1);
+
+        Raster::Rasterizer rasterizer(obj_path, tex_path);
+        Obj::ObjSet* obj = rasterizer.obj_set[0];
+        rasterizer.add_light(Raster::Rasterizer::LightType::POINTLIGHT, 20, light_color, 1024, PI / 2, Eigen::Vector3f(2, 4, 4));
+        rasterizer.shadow_bake(false);
+        Eigen::Vector3f position(-1, 0, 5);
+        Eigen::Vector3f lookat = -position;
+        rasterizer.config_camera(Raster::Camera::Projection::PERSP, bg_color, w, h, PI / 2, position, lookat);
+        Raster::Camera& camera = rasterizer.camera;
+        camera.init_buffs();
+        camera.project_vertices(rasterizer.obj_set, false);
+        if(obj->texture){
+            obj->texture->load();
+        }
+
+        const double tris = obj->triangles.size();
+        const double verts = obj->vertices.size();
+        const double edges = obj->edges.size();
+        const double pixels = (double)w * h;
+        const double frame_bytes = pixels * (int)bg_color.image_color * sizeof(float);
+
+        std::cout << obj_path << ": " << obj->vertices.size() << " vertices, " << obj->triangles.size() << " triangles, "
+                  << w << "x" << h << ", " << thread_count() << " thread(s)" << std::endl;
+        std::cout << std::left << std::setw(36) << "case" << std::right << std::setw(7) << "runs"
+                  << std::setw(12) << "best ms" << std::setw(12) << "median ms" << "  throughput (best)" << std::endl;
+
+        // load
+        const double obj_bytes = std::filesystem::file_size(obj_path);
+        Bench::run(options, "obj parse", { { obj_bytes, "B" }, { tris, "tris" } }, [&](){
+            Obj::ObjSet parsed(obj_path, "");
+            parsed.clear_heap();
+        });
+        Bench::run(options, "adjacency", { { edges, "edges" } }, [&](){
+            obj->build_adjacency();
+        });
+        Bench::run(options, "feature edges", { { edges, "edges" } }, [&](){
+            obj->build_feature_edges();
+        });
+        Bench::run(options, "build lods", { { tris, "tris" } }, [&](){
+            Obj::build_lods(*obj, 4);
+        });
+        obj->clear_lods();
+
+        // geometry
+        Bench::run(options, "project_vertices", { { verts, "verts" }, { tris, "tris" } }, [&](){
+            camera.project_vertices(rasterizer.obj_set, false);
+        }, [&](){
+            obj->revision++; // defeat the projection cache
+        });
+        Bench::DepthShader depth_shader;
+        camera.paint(depth_shader, rasterizer.obj_set, fill_color, false, false);
+        const double fragments_per_frame = camera.stats.fragments_shaded;
+        for(int tile : { 0, 8, 32 }){
+            camera.set_buff_tile(tile);
+            Bench::run(options, tile ? "rasterize (z only) " + std::to_string(tile) + "x" + std::to_string(tile) : std::string("rasterize (z only)"), { { tris, "tris" }, { fragments_per_frame, "px" } }, [&](){
+                camera.paint(depth_shader, rasterizer.obj_set, fill_color, false, false);
+            });
+        }
+        camera.set_buff_tile(0);
+        for(Raster::Camera::DepthFormat format : { Raster::Camera::DepthFormat::UNORM24, Raster::Camera::DepthFormat::UNORM16 }){
+            camera.set_formats(Raster::Camera::ColorFormat::FLOAT, format);
+            Bench::run(options, format == Raster::Camera::DepthFormat::UNORM24 ? "rasterize (z only) depth 24" : "rasterize (z only) depth 16", { { tris, "tris" }, { fragments_per_frame, "px" } }, [&](){
+                camera.paint(depth_shader, rasterizer.obj_set, fill_color, false, false);
+            });
+        }
+        camera.set_formats(Raster::Camera::ColorFormat::FLOAT, Raster::Camera::DepthFormat::FLOAT);
+
+        // per-fragment work, on random points of the visible triangles
+        const Raster::ProjectedMesh& mesh = camera.projected[0];
+        std::vector<const Obj::Triangle*> visible;
+        for(const Obj::Triangle* triangle : obj->triangles){
+            if(Raster::Camera::is_triangle_visible(mesh.triangle(triangle), false)){
+                visible.push_back(triangle);
+            }
+        }
+        if(visible.empty()){
+            throw Manga3DException("bench: no triangle is visible from the benchmark camera");
+        }
+        std::vector<Bench::Fragment> fragments;
+        fragments.reserve(fragment_count);
+        for(int i = 0;i < fragment_count;i++){
+            const Obj::Triangle* triangle = visible[rng() % visible.size()];
+            float r1 = std::sqrt(unit(rng));
+            float r2 = unit(rng);
+            fragments.push_back({ triangle, mesh.triangle(triangle), Eigen::Vector3f(1 - r1, r1 * (1 - r2), r1 * r2) });
+        }
+        auto shade_all = [&](Raster::Shader& shader){
+            float color[4];
+            shader.begin_object(obj);
+            for(const Bench::Fragment& fragment : fragments){
+                float z = -MAX_F;
+                shader.shade(obj, fragment.triangle, fragment.projected, fragment.bc_coord, fill_color, &z, color, false);
+            }
+        };
+        Raster::OutlineShader outline_shader(2, 1, 1, line_color);
+        Raster::TextureShader texture_shader;
+        Raster::PhoneShader phone_shader(rasterizer.lights, 0.05, false);
+        Raster::PhoneShader phone_interpolated_shader(rasterizer.lights, 0.05, false);
+        phone_interpolated_shader.interpolate_shadow = true;
+        Raster::DiscreteShader discrete_shader(rasterizer.lights, 0.05, false);
+        Raster::DiscreteShader discrete_pcf_shader(rasterizer.lights, 0.05, true);
+        Raster::Light* light = rasterizer.lights[0];
+        Raster::SMShader sm_shader([light](Eigen::Vector3f& point){ return light->get_distance(point); });
+        Bench::run(options, "shade outline", { { (double)fragment_count, "px" } }, [&](){ shade_all(outline_shader); });
+        Bench::run(options, "shade texture", { { (double)fragment_count, "px" } }, [&](){ shade_all(texture_shader); });
+        Bench::run(options, "shade phong", { { (double)fragment_count, "px" } }, [&](){ shade_all(phone_shader); });
+        Bench::run(options, "shade phong interpolated", { { (double)fragment_count, "px" } }, [&](){ shade_all(phone_interpolated_shader); });
+        Bench::run(options, "shade discrete", { { (double)fragment_count, "px" } }, [&](){ shade_all(discrete_shader); });
+        Bench::run(options, "shade discrete pcf", { { (double)fragment_count, "px" } }, [&](){ shade_all(discrete_pcf_shader); });
+        Bench::run(options, "shade shadow map", { { (double)fragment_count, "px" } }, [&](){ shade_all(sm_shader); });
+
+        volatile float sink = 0;
+        for(bool interpolated : { false, true }){
+            begin_light_space(rasterizer.lights, interpolated ? obj : nullptr, 0.05);
+            for(bool pcf : { false, true }){
+                const std::string name = std::string("light_reach") + (pcf ? " pcf" : "") + (interpolated ? " interpolated" : "");
+                Bench::run(options, name, { { (double)fragment_count, "px" } }, [&](){
+                    float sum = 0;
+                    for(const Bench::Fragment& fragment : fragments){
+                        Raster::Color color = light_reach(rasterizer.lights, obj, fragment.triangle, fragment.projected, fill_color, fragment.bc_coord, 0.05, pcf);
+                        sum += color.color[0];
+                    }
+                    sink = sink + sum;
+                });
+            }
+        }
+        begin_light_space(rasterizer.lights, nullptr, 0.05);
+        Bench::run(options, "light space", { { verts, "verts" } }, [&](){
+            begin_light_space(rasterizer.lights, obj, 0.05);
+        });
+        begin_light_space(rasterizer.lights, nullptr, 0.05);
+        if(obj->texture){
+            std::vector<Eigen::Vector2f> uv(fragment_count);
+            for(Eigen::Vector2f& p : uv){
+                p = Eigen::Vector2f(unit(rng), unit(rng));
+            }
+            const Tex::Texture& texture = *obj->texture;
+            Bench::run(options, "bilinear_sampling", { { (double)fragment_count, "samples" } }, [&](){
+                Eigen::Vector3f sum(0, 0, 0);
+                for(const Eigen::Vector2f& p : uv){
+                    sum += texture.bilinear_sampling(p[0], p[1]);
+                }
+                sink = sink + sum[0];
+            });
+        }
+
+        // lines
+        std::vector<std::pair<Eigen::Vector3f, Eigen::Vector3f>> lines(line_count);
+        double line_px = 0;
+        for(auto& line : lines){
+            line.first = Eigen::Vector3f(unit(rng) * w, unit(rng) * h, -1 - unit(rng));
+            line.second = line.first + Eigen::Vector3f((unit(rng) - 0.5f) * 200, (unit(rng) - 0.5f) * 200, 0);
+            line_px += std::max(std::abs(line.second[0] - line.first[0]), std::abs(line.second[1] - line.first[1]));
+        }
+        Bench::run(options, "paint_line_simple", { { (double)line_count, "lines" }, { line_px, "px" } }, [&](){
+            for(const auto& line : lines){
+                camera.paint_line_simple(line.first, line.second, line_color, 2);
+            }
+        }, [&](){
+            camera.init_buffs();
+        });
+
+        // storage formats of a shaded frame, floats against 8-bit color and 16-bit depth
+        Bench::run(options, "paint phong", { { pixels, "px" }, { frame_bytes, "B" } }, [&](){
+            rasterizer.paint_phoneshading(fill_color, 0.05, false, false, false);
+        });
+        rasterizer.set_formats(Raster::Camera::ColorFormat::UNORM8, Raster::Camera::DepthFormat::UNORM16);
+        Bench::run(options, "paint phong color 8 depth 16", { { pixels, "px" }, { pixels * (double)(camera.color_bytes() + camera.depth_bytes()), "B" } }, [&](){
+            rasterizer.paint_phoneshading(fill_color, 0.05, false, false, false);
+        });
+        rasterizer.set_formats(Raster::Camera::ColorFormat::FLOAT, Raster::Camera::DepthFormat::FLOAT);
+
+        // post-process and output, on a shaded frame
+        camera.track_shade = true;
+        rasterizer.paint_phoneshading(fill_color, 0.05, false, false, false);
+        camera.track_shade = false;
+        Bench::run(options, "simple_aa", { { pixels, "px" }, { frame_bytes, "B" } }, [&](){
+            rasterizer.simple_aa();
+        });
+        Bench::run(options, "tone dots", { { pixels, "px" }, { frame_bytes, "B" } }, [&](){
+            rasterizer.tone(Raster::ToneStage::Pattern::DOTS, 6, Raster::Color(0, 0, 0));
+        });
+        Output::Image image(camera);
+        std::vector<uint8_t> quantized(image.data.size());
+        Bench::run(options, "quantize 8 bit", { { pixels, "px" }, { frame_bytes, "B" } }, [&](){
+            Output::quantize_8(image.data.data(), quantized.data(), image.data.size());
+        });
+        const std::filesystem::path out_dir = std::filesystem::temp_directory_path() / "manga3d_bench";
+        std::filesystem::create_directories(out_dir);
+        for(const char* extension : { ".qoi", ".png", ".pfm" }){
+            const std::string path = (out_dir / (std::string("frame") + extension)).string();
+            Bench::run(options, std::string("write ") + (extension + 1), { { pixels, "px" }, { frame_bytes, "B" } }, [&](){
+                Output::write(image, path);
+            });
+        }
+        std::filesystem::remove_all(out_dir);
+
+        // many small point lights, binned per screen tile or evaluated at every pixel
+        const int extra_lights = 32;
+        for(int l = 0;l < extra_lights;l++){
+            Eigen::Vector3f position(unit(rng) * 4 - 2, unit(rng) * 4 - 2, unit(rng) * 4 - 2);
+            rasterizer.add_light(Raster::Rasterizer::LightType::POINTLIGHT, 0.01, light_color, 256, PI / 2, position);
+        }
+        Bench::run(options, "shadow bake 33 lights", { { (double)rasterizer.lights.size(), "lights" } }, [&](){
+            rasterizer.shadow_bake(false);
+        });
+        for(int tile : { 16, 0 }){
+            rasterizer.set_light_tile(tile);
+            Bench::run(options, tile ? "paint 33 lights tiled" : "paint 33 lights", { { pixels, "px" } }, [&](){
+                rasterizer.paint_phoneshading(fill_color, 0.05, false, false, false);
+            });
+        }
+        rasterizer.set_light_tile(16);
+        Raster::DiscreteShader interpolated_shader(rasterizer.lights, 0.05, false);
+        interpolated_shader.interpolate_shadow = true;
+        interpolated_shader.set_outline(2, 1, 1, line_color);
+        Bench::run(options, "paint 33 lights tiled interpolated", { { pixels, "px" } }, [&](){
+            rasterizer.paint_shader(interpolated_shader, fill_color, false, false);
+        });
+        return 0;
+    }
+    catch(const std::exception& e){
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
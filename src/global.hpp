@@ -7,6 +7,8 @@
 #include <iostream>
 #include <string>
 #include <optional>
+#include <thread>
+#include <exception>
 
 
 
@@ -48,13 +50,7 @@ inline const float min(const float a, const float b){
     return b;
 }
 inline const float min(const float a, const float b, const float c){
-    if(a < b && a < c){
-        return a;
-    }
-    if(b < a && b < c){
-        return b;
-    }
-    return c;
+    return min(min(a, b), c);
 }
 
 inline const float max(const float a, const float b){
@@ -64,13 +60,7 @@ inline const float max(const float a, const float b){
     return b;
 }
 inline const float max(const float a, const float b, const float c){
-    if(a > b && a > c){
-        return a;
-    }
-    if(b > a && b > c){
-        return b;
-    }
-    return c;
+    return max(max(a, b), c);
 }
 
 inline const Eigen::Vector3f min(const Eigen::Vector3f a, const Eigen::Vector3f b){
@@ -102,9 +92,81 @@ inline const bool no_more_than(const float a, const float b){
 }
 
 
-inline void print_progress(const int i, const int total, const std::string message){
-    std::cout.flush();
-    std::cout << message << ": " << i << "/" << total << "\r";
+/*
+worker count used by parallel_for(), defaults to the hardware concurrency
+*/
+inline int& thread_count(){
+    static int count = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+    return count;
+}
+
+/*
+workers parallel_for() may use from the current thread, 0 means thread_count()
+each range of a parallel_for() runs with an even split of its caller's share,
+so nested loops (views painted concurrently, each with parallel passes) do not oversubscribe
+*/
+inline int& thread_share(){
+    thread_local int share = 0;
+    return share;
+}
+
+/*
+split [begin, end) into contiguous ranges and call func(range_begin, range_end) on each,
+one range per worker, the calling thread takes the first one
+exceptions thrown inside a worker are rethrown on the calling thread
+*/
+template<typename F>
+inline void parallel_for(const int begin, const int end, F&& func, const int grain = 1){
+    int n = end - begin;
+    if(n <= 0){
+        return;
+    }
+    const int budget = thread_share() > 0 ? thread_share() : thread_count();
+    int workers = budget;
+    if(workers > (n + grain - 1) / grain){
+        workers = (n + grain - 1) / grain;
+    }
+    if(workers <= 1){
+        func(begin, end);
+        return;
+    }
+    int chunk = (n + workers - 1) / workers;
+    const int share = budget / workers > 1 ? budget / workers : 1;
+    std::vector<std::thread> threads;
+    std::vector<std::exception_ptr> errors(workers);
+    for(int t = 1;t < workers;t++){
+        int b = begin + t * chunk;
+        int e = b + chunk < end ? b + chunk : end;
+        if(b >= e){
+            break;
+        }
+        threads.emplace_back([&func, &errors, share, t, b, e](){
+            thread_share() = share;
+            try{
+                func(b, e);
+            }
+            catch(...){
+                errors[t] = std::current_exception();
+            }
+        });
+    }
+    const int caller_share = thread_share();
+    thread_share() = share;
+    try{
+        func(begin, begin + chunk);
+    }
+    catch(...){
+        errors[0] = std::current_exception();
+    }
+    thread_share() = caller_share;
+    for(std::thread& thread : threads){
+        thread.join();
+    }
+    for(std::exception_ptr& error : errors){
+        if(error){
+            std::rethrow_exception(error);
+        }
+    }
 }
 
 
@@ -113,6 +175,8 @@ inline void print_progress(const int i, const int total, const std::string messa
 
 
 
+
+
 class Manga3DException: public std::exception{
     std::string message;
 public:
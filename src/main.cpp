@@ -4,9 +4,22 @@
 
 #include "global.hpp"
 #include "./raster/Rasterizer.hpp"
+#include "./output/Output.hpp"
 
 
-void show_image(Raster::Camera& camera, std::optional<std::string> filename = std::nullopt){
+void show_image(Raster::Camera& camera, std::optional<std::string> filename = std::nullopt, bool headless = false){
+    if(filename.has_value()){
+#if defined(_WIN32) || defined(_WIN64)
+        std::string path = ".\\output\\";
+#else
+        std::string path = "./output/";
+#endif
+        std::string suffix = ".png";
+        Output::write(camera, path + filename.value() + suffix);
+    }
+    if(headless){
+        return;
+    }
     cv::Mat image;
     cv::Mat image_2c;
     std::vector<cv::Mat> channels2;
@@ -14,42 +27,31 @@ void show_image(Raster::Camera& camera, std::optional<std::string> filename = st
     switch(camera.bg_color.image_color){
     case Raster::Color::ImageColor::FULLCOLORALPHA:
         image = cv::Mat(camera.h, camera.w, CV_32FC4, camera.top_buff);
-        image *= 256;
-        image.convertTo(image, CV_8UC4);
         break;
     case Raster::Color::ImageColor::FULLCOLOR:
         image = cv::Mat(camera.h, camera.w, CV_32FC3, camera.top_buff);
-        image *= 256;
-        image.convertTo(image, CV_8UC3);
         break;
     case Raster::Color::ImageColor::BLACKWHITEALPHA:
         image_2c = cv::Mat(camera.h, camera.w, CV_32FC2, camera.top_buff);
         cv::split(image_2c, channels2);
         channels4 = { channels2[0],channels2[0].clone(),channels2[0].clone(),channels2[1] };
         cv::merge(channels4, image);
-        image *= 256;
-        image.convertTo(image, CV_8UC4);
         break;
     default:
         image = cv::Mat(camera.h, camera.w, CV_32FC1, camera.top_buff);
-        image *= 256;
-        image.convertTo(image, CV_8UC1);
         break;
     }
-    if(filename.has_value()){
-#if defined(_WIN32) || defined(_WIN64)
-        std::string path = ".\\output\\";
-#else
-        std::string path = "./output/";
-#endif
-        std::string suffix = ".png";
-        cv::imwrite(path + filename.value() + suffix, image);
-    }
     cv::imshow("image", image);
     cv::waitKey(0);
 }
 
-int main(){
+int main(int argc, char** argv){
+    bool headless = false;
+    for(int i = 1;i < argc;i++){
+        if(std::string(argv[i]) == "--headless"){
+            headless = true;
+        }
+    }
     
     Raster::Color bg_color(1,1,1);
     Raster::Color line_color(0,0,0);
@@ -73,7 +75,7 @@ int main(){
     rasterizer.simple_aa();
 
     std::cout << std::endl << "showing image" << std::endl;
-    show_image(rasterizer.camera, "monkey");
+    show_image(rasterizer.camera, "monkey", headless);
 
     return 0;
 }
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <fstream>
+#include <algorithm>
+#include <atomic>
 
 #include "../global.hpp"
+#include "../BVH.hpp"
 #include "texture.hpp"
 
 
@@ -37,8 +40,8 @@ namespace Obj{
 
     class Vertex{
     public:
+        int index; // position in ObjSet::vertices, keys per-camera projections
         Vector3f position;
-        Vector3f projected_position;
         std::vector<Edge*> as_start;
         std::vector<Edge*> as_end;
     };
@@ -49,20 +52,14 @@ namespace Obj{
         Vertex* end;
         Triangle* triangle;
         Edge* reverse;
+        float crease_cos; // cosine between the world face normals of both sides, 1 on boundary, set at load
 
-        Edge(): start(nullptr), end(nullptr), triangle(nullptr), reverse(nullptr){}
-
-        float point_distance_2d(int x, int y) const{
-            float Y = start->projected_position[1] - end->projected_position[1];
-            float X = end->projected_position[0] - start->projected_position[0];
-            return (std::abs(Y * x + X * y + start->projected_position[0] * end->projected_position[1] - end->projected_position[0] * start->projected_position[1]) / std::sqrt(X * X + Y * Y));
-        }
+        Edge(): start(nullptr), end(nullptr), triangle(nullptr), reverse(nullptr), crease_cos(1){}
 
         bool is_boundary() const{
             return reverse == NULL;
         }
         bool is_crease(float angle) const;
-        bool is_silhouette() const;
     };
 
     class Triangle{
@@ -80,34 +77,14 @@ namespace Obj{
         Edge* BC;
         Edge* CA;
         bool is_smooth;
-        std::optional<Vector3f> normal;
+        Vector3f face_normal; // world space, set at load
 
-        Triangle(): A(nullptr), B(nullptr), C(nullptr), AB(nullptr), BC(nullptr), CA(nullptr), is_smooth(false){};
+        int index; // position in ObjSet::triangles
 
-        inline void calculate_normal(){
-            this->normal = ((this->B->projected_position - this->A->projected_position).cross(this->A->projected_position - this->C->projected_position)).normalized();
-        }
-        inline bool is_inside_triangle(int x, int y) const{
-            float ax, ay, bx, by, cx, cy;
-            ax = this->A->projected_position[0] - x;
-            ay = this->A->projected_position[1] - y;
-            bx = this->B->projected_position[0] - x;
-            by = this->B->projected_position[1] - y;
-            cx = this->C->projected_position[0] - x;
-            cy = this->C->projected_position[1] - y;
-            float v0, v1, v2;
-            v0 = ax * by - ay * bx;
-            v1 = bx * cy - by * cx;
-            v2 = cx * ay - cy * ax;
-            return (v0 < EPSILON && v1 < EPSILON && v2 < EPSILON) || (v0 > -EPSILON && v1 > -EPSILON && v2 > -EPSILON);
-        }
+        Triangle(): A(nullptr), B(nullptr), C(nullptr), AB(nullptr), BC(nullptr), CA(nullptr), is_smooth(false), face_normal(0, 0, 0), index(-1){};
 
-        inline Vector3f get_barycentric_coordinate(int x, int y) const{
-            float alpha, beta, gama;
-            alpha = (-(x - this->B->projected_position[0]) * (this->C->projected_position[1] - this->B->projected_position[1]) + (y - this->B->projected_position[1]) * (this->C->projected_position[0] - this->B->projected_position[0])) / (-(this->A->projected_position[0] - this->B->projected_position[0]) * (this->C->projected_position[1] - this->B->projected_position[1]) + (this->A->projected_position[1] - this->B->projected_position[1]) * (this->C->projected_position[0] - this->B->projected_position[0]));
-            beta = (-(x - this->C->projected_position[0]) * (this->A->projected_position[1] - this->C->projected_position[1]) + (y - this->C->projected_position[1]) * (this->A->projected_position[0] - this->C->projected_position[0])) / (-(this->B->projected_position[0] - this->C->projected_position[0]) * (this->A->projected_position[1] - this->C->projected_position[1]) + (this->B->projected_position[1] - this->C->projected_position[1]) * (this->A->projected_position[0] - this->C->projected_position[0]));
-            gama = 1 - alpha - beta;
-            return Vector3f(alpha, beta, gama);
+        inline void calculate_face_normal(){
+            this->face_normal = ((this->B->position - this->A->position).cross(this->A->position - this->C->position)).normalized();
         }
         inline Vector3f get_position_from_barycentric(const Vector3f& barycentric) const{
             Vector3f position;
@@ -145,24 +122,7 @@ namespace Obj{
         if(reverse == NULL){
             return false;
         }
-        try{
-            float cost = this->triangle->normal.value().dot(this->reverse->triangle->normal.value());
-            return cost < std::cos(angle);
-        }
-        catch(const std::bad_optional_access& e){
-            throw Manga3DException("triangle->normal is not calculated", e);
-        }
-    }
-    bool Edge::is_silhouette() const{
-        try{
-            if(this->triangle->normal.value()[2] > 0 && this->reverse->triangle->normal.value()[2] < 0){
-                return true;
-            }
-            return false;
-        }
-        catch(const std::bad_optional_access& e){
-            throw Manga3DException("triangle->normal is not calculated", e);
-        }
+        return crease_cos < std::cos(angle);
     }
 
 
@@ -174,15 +134,35 @@ namespace Obj{
         std::vector<Obj::Vertex*> vertices;
         std::vector<Obj::Edge*> edges;
         std::vector<Obj::Triangle*> triangles;
-        std::optional<Tex::Texture> texture;
+        std::shared_ptr<Tex::Texture> texture; // shared through Tex::TextureRegistry
+
+        std::vector<Obj::Edge*> boundary_edges; // edges without reverse
+        std::vector<Obj::Edge*> interior_edges; // one edge per reverse pair, ascending crease_cos
+
+        Eigen::Matrix3Xf positions; // one column per vertex, contiguous copy of Vertex::position for batched transforms
+        BVH::Tree clusters; // over `triangles`, leaves are the clusters of front-to-back painting
+        uint64_t id; // unique per loaded mesh
+        uint64_t revision; // bumped whenever vertex positions change, keys cached projections
+
+        std::vector<Obj::ObjSet*> lods; // coarser levels, each about half the triangles of the previous, see Obj::build_lods()
+        std::vector<float> lod_errors; // world-space simplification error of each level, ascending
+
+        const Obj::ObjSet* instance_of = nullptr; // shared mesh of an instance, which holds no vertices or triangles itself
+        Eigen::Matrix4f model = Eigen::Matrix4f::Identity(); // affine mesh to world transform of an instance
+        Eigen::Matrix3f normal_matrix = Eigen::Matrix3f::Identity(); // inverse transpose of the linear part of `model`
+
+        static uint64_t next_id(){
+            static std::atomic<uint64_t> counter(0);
+            return ++counter;
+        }
 
         /*
         vertex_list,edge_list,triangle_list have elements allocated on the heap
         use `clear_heap()` to delete them
         */
-        ObjSet(const std::string& obj_path, const std::string& tex_path){
+        ObjSet(const std::string& obj_path, const std::string& tex_path): id(next_id()), revision(0){
             if(tex_path != ""){
-                this->texture = Tex::Texture(tex_path);
+                this->texture = Tex::TextureRegistry::instance().get(tex_path);
             }
 
             std::vector<ObjFile::v> raw_v;
@@ -250,76 +230,236 @@ namespace Obj{
 
 
                 for(const ObjFile::v& _v : raw_v){
-                    Obj::Vertex* vertex = new Obj::Vertex();
-                    vertex->position = Eigen::Vector3f(_v.x, _v.y, _v.z);
-                    this->vertices.push_back(vertex);
+                    add_vertex(Eigen::Vector3f(_v.x, _v.y, _v.z));
                 }
 
                 for(const ObjFile::f& _f : raw_f){
                     for(int i = 0;i < _f.n_v - 2;i++){
-                        Obj::Triangle* triangle = new Obj::Triangle();
-                        this->triangles.push_back(triangle);
-
+                        Obj::Triangle* triangle = add_triangle(this->vertices[_f.index[0] - 1], this->vertices[_f.index[(i + 1) * _f.n_p] - 1], this->vertices[_f.index[(i + 2) * _f.n_p] - 1]);
                         triangle->is_smooth = _f.is_smooth;
-                        triangle->A = this->vertices[_f.index[0] - 1];
                         if(_f.index[1] <= raw_vt.size()){
                             triangle->A_texture_uv = Eigen::Vector2f(raw_vt[_f.index[1] - 1].u, raw_vt[_f.index[1] - 1].v);
                         }
                         if(_f.index[2] <= raw_vn.size()){
                             triangle->A_normal = Eigen::Vector3f(raw_vn[_f.index[2] - 1].x, raw_vn[_f.index[2] - 1].y, raw_vn[_f.index[2] - 1].z);
                         }
-                        triangle->B = this->vertices[_f.index[(i + 1) * _f.n_p] - 1];
                         if(_f.index[(i + 1) * _f.n_p + 1] <= raw_vt.size()){
                             triangle->B_texture_uv = Eigen::Vector2f(raw_vt[_f.index[(i + 1) * _f.n_p + 1] - 1].u, raw_vt[_f.index[(i + 1) * _f.n_p + 1] - 1].v);
                         }
                         if(_f.index[(i + 1) * _f.n_p + 2] <= raw_vn.size()){
                             triangle->B_normal = Eigen::Vector3f(raw_vn[_f.index[(i + 1) * _f.n_p + 2] - 1].x, raw_vn[_f.index[(i + 1) * _f.n_p + 2] - 1].y, raw_vn[_f.index[(i + 1) * _f.n_p + 2] - 1].z);
                         }
-                        triangle->C = this->vertices[_f.index[(i + 2) * _f.n_p] - 1];
                         if(_f.index[(i + 2) * _f.n_p + 1] <= raw_vt.size()){
                             triangle->C_texture_uv = Eigen::Vector2f(raw_vt[_f.index[(i + 2) * _f.n_p + 1] - 1].u, raw_vt[_f.index[(i + 2) * _f.n_p + 1] - 1].v);
                         }
                         if(_f.index[(i + 2) * _f.n_p + 2] <= raw_vn.size()){
                             triangle->C_normal = Eigen::Vector3f(raw_vn[_f.index[(i + 2) * _f.n_p + 2] - 1].x, raw_vn[_f.index[(i + 2) * _f.n_p + 2] - 1].y, raw_vn[_f.index[(i + 2) * _f.n_p + 2] - 1].z);
                         }
+                    }
+                }
+
+                build();
+            }
+            else{
+                throw Manga3DException("Obj: .obj file is not opened, " + obj_path);
+            }
+        }
+        /*
+        empty mesh built in memory, add_vertex() and add_triangle() then `build()`
+        `texture` may be shared with another ObjSet
+        */
+        ObjSet(std::shared_ptr<Tex::Texture> texture = nullptr): texture(texture), id(next_id()), revision(0){}
+        /*
+        instance of `mesh` placed by `model`, only the matrix and the levels of detail are stored,
+        vertices, triangles and edges are read through `geometry()`
+        `mesh` must outlive the instance and keep its topology, vertex edits show in every instance
+        */
+        ObjSet(const Obj::ObjSet* mesh, const Eigen::Matrix4f& model): texture(mesh->texture), id(next_id()), revision(0){
+            this->instance_of = &mesh->geometry();
+            this->model = model * mesh->model;
+            this->normal_matrix = this->model.topLeftCorner<3, 3>().inverse().transpose();
+            link_lods();
+        }
+
+        Obj::Vertex* add_vertex(const Eigen::Vector3f& position){
+            Obj::Vertex* vertex = new Obj::Vertex();
+            vertex->index = this->vertices.size();
+            vertex->position = position;
+            this->vertices.push_back(vertex);
+            return vertex;
+        }
+        /*corner uv, normals and is_smooth are left to the caller*/
+        Obj::Triangle* add_triangle(Obj::Vertex* A, Obj::Vertex* B, Obj::Vertex* C){
+            Obj::Triangle* triangle = new Obj::Triangle();
+            triangle->index = this->triangles.size();
+            this->triangles.push_back(triangle);
+            triangle->A = A;
+            triangle->B = B;
+            triangle->C = C;
+            triangle->AB = add_edge(triangle, A, B);
+            triangle->BC = add_edge(triangle, B, C);
+            triangle->CA = add_edge(triangle, C, A);
+            return triangle;
+        }
+        Obj::Edge* add_edge(Obj::Triangle* triangle, Obj::Vertex* start, Obj::Vertex* end){
+            Obj::Edge* edge = new Obj::Edge();
+            this->edges.push_back(edge);
+            edge->start = start;
+            start->as_start.push_back(edge);
+            edge->end = end;
+            end->as_end.push_back(edge);
+            edge->triangle = triangle;
+            return edge;
+        }
+        inline bool is_instance() const{
+            return this->instance_of != nullptr;
+        }
+        /*the ObjSet holding vertices, triangles, edges and clusters, the shared mesh of an instance*/
+        inline const Obj::ObjSet& geometry() const{
+            return this->instance_of ? *this->instance_of : *this;
+        }
+        /*changes whenever the world positions change, keys cached projections*/
+        inline uint64_t world_revision() const{
+            return this->instance_of ? this->revision + this->instance_of->revision : this->revision;
+        }
+        /*world space of a mesh space position or normal, identity unless this is an instance*/
+        inline Vector3f to_world(const Vector3f& position) const{
+            return this->instance_of ? Vector3f(this->model.topLeftCorner<3, 3>() * position + this->model.topRightCorner<3, 1>()) : position;
+        }
+        inline Vector3f normal_to_world(const Vector3f& normal) const{
+            return this->instance_of ? Vector3f((this->normal_matrix * normal).normalized()) : normal;
+        }
+        inline BVH::BBox to_world(const BVH::BBox& bbox) const{
+            return this->instance_of ? bbox.transformed(this->model) : bbox;
+        }
+        /*world bounds, empty box without triangles*/
+        inline BVH::BBox bounds() const{
+            const Obj::ObjSet& mesh = geometry();
+            return mesh.clusters.empty() ? BVH::BBox() : to_world(mesh.clusters.nodes[0].bbox);
+        }
+        /*largest stretch of a model matrix, scales world-space errors*/
+        static inline float max_scale(const Eigen::Matrix4f& model){
+            return model.topLeftCorner<3, 3>().colwise().norm().maxCoeff();
+        }
+        /*instances of the shared mesh's `lods` under this instance's `model`, call after the mesh rebuilds its levels*/
+        void link_lods(){
+            if(!this->instance_of){
+                return;
+            }
+            clear_lods();
+            const float scale = max_scale(this->model);
+            for(int i = 0;i < (int)this->instance_of->lods.size();i++){
+                this->lods.push_back(new Obj::ObjSet(this->instance_of->lods[i], this->model));
+                this->lod_errors.push_back(this->instance_of->lod_errors[i] * scale);
+            }
+        }
 
-                        triangle->AB = new Obj::Edge();
-                        this->edges.push_back(triangle->AB);
-                        triangle->AB->start = triangle->A;
-                        triangle->A->as_start.push_back(triangle->AB);
-                        triangle->AB->end = triangle->B;
-                        triangle->B->as_end.push_back(triangle->AB);
-                        triangle->AB->triangle = triangle;
-                        triangle->BC = new Obj::Edge();
-                        this->edges.push_back(triangle->BC);
-                        triangle->BC->start = triangle->B;
-                        triangle->B->as_start.push_back(triangle->BC);
-                        triangle->BC->end = triangle->C;
-                        triangle->C->as_end.push_back(triangle->BC);
-                        triangle->BC->triangle = triangle;
-                        triangle->CA = new Obj::Edge();
-                        this->edges.push_back(triangle->CA);
-                        triangle->CA->start = triangle->C;
-                        triangle->C->as_start.push_back(triangle->CA);
-                        triangle->CA->end = triangle->A;
-                        triangle->A->as_end.push_back(triangle->CA);
-                        triangle->CA->triangle = triangle;
+        /*derived data once every vertex and triangle is added*/
+        void build(){
+            build_adjacency();
+            build_feature_edges();
+            update_positions();
+        }
+
+        /*links every half edge to its reverse through the edges leaving its end vertex*/
+        void build_adjacency(){
+            for(Obj::Edge* edge : this->edges){
+                edge->reverse = NULL;
+                for(Obj::Edge* reverse : edge->start->as_end){
+                    if(reverse->start == edge->end){
+                        edge->reverse = reverse;
+                        break;
                     }
                 }
+            }
+        }
 
-                for(Obj::Edge* edge : this->edges){
-                    for(Obj::Edge* reverse : edge->start->as_end){
-                        if(reverse->start == edge->end){
-                            edge->reverse = reverse;
-                            break;
-                        }
+        /*
+        view-independent part of outline extraction, world face normals and crease cosines
+        creases for any angle are then the prefix of `interior_edges` with crease_cos < cos(angle)
+        */
+        void build_feature_edges(){
+            for(Obj::Triangle* triangle : this->triangles){
+                triangle->calculate_face_normal();
+            }
+            this->boundary_edges.clear();
+            this->interior_edges.clear();
+            for(Obj::Edge* edge : this->edges){
+                if(edge->reverse == NULL){
+                    edge->crease_cos = 1;
+                    this->boundary_edges.push_back(edge);
+                    continue;
+                }
+                edge->crease_cos = edge->triangle->face_normal.dot(edge->reverse->triangle->face_normal);
+                if(!std::isfinite(edge->crease_cos)){ // degenerate triangle
+                    edge->crease_cos = 1;
+                }
+                if(edge < edge->reverse || edge->reverse->reverse != edge){
+                    this->interior_edges.push_back(edge);
+                }
+            }
+            std::stable_sort(this->interior_edges.begin(), this->interior_edges.end(), [](const Obj::Edge* a, const Obj::Edge* b){
+                return a->crease_cos < b->crease_cos;
+            });
+        }
+        /*number of leading `interior_edges` that are creases for `angle`*/
+        inline int crease_count(float angle) const{
+            float cos_angle = std::cos(angle);
+            return std::lower_bound(this->interior_edges.begin(), this->interior_edges.end(), cos_angle, [](const Obj::Edge* edge, float c){
+                return edge->crease_cos < c;
+            }) - this->interior_edges.begin();
+        }
+
+        /*
+        moves the mesh and its `lods` into place with a model matrix, per-corner normals use its inverse transpose
+        face normals and crease order are rebuilt afterwards, an instance only composes the matrix
+        */
+        void transform(const Eigen::Matrix4f& model){
+            if(this->instance_of){
+                this->model = model * this->model;
+                this->normal_matrix = this->model.topLeftCorner<3, 3>().inverse().transpose();
+                this->revision++;
+                link_lods();
+                return;
+            }
+            const Eigen::Matrix3f normal_matrix = model.topLeftCorner<3, 3>().inverse().transpose();
+            for(Obj::Vertex* vertex : this->vertices){
+                vertex->position = (model * vertex->position.homogeneous()).hnormalized();
+            }
+            for(Obj::Triangle* triangle : this->triangles){
+                for(std::optional<Vector3f>* normal : { &triangle->A_normal, &triangle->B_normal, &triangle->C_normal }){
+                    if(normal->has_value()){
+                        *normal = (normal_matrix * normal->value()).normalized();
                     }
                 }
             }
-            else{
-                throw Manga3DException("Obj: .obj file is not opened, " + obj_path);
+            build_feature_edges();
+            update_positions();
+            const float scale = max_scale(model);
+            for(int i = 0;i < (int)this->lods.size();i++){
+                this->lods[i]->transform(model);
+                this->lod_errors[i] *= scale;
             }
         }
+        /*
+        refresh `positions` and `clusters` from the vertices and invalidate cached projections,
+        call after editing Vertex::position directly
+        */
+        void update_positions(){
+            this->positions.resize(3, this->vertices.size());
+            for(int i = 0;i < (int)this->vertices.size();i++){
+                this->positions.col(i) = this->vertices[i]->position;
+            }
+            std::vector<BVH::BBox> boxes(this->triangles.size());
+            for(int t = 0;t < (int)this->triangles.size();t++){
+                const Obj::Triangle* triangle = this->triangles[t];
+                boxes[t].extend(triangle->A->position);
+                boxes[t].extend(triangle->B->position);
+                boxes[t].extend(triangle->C->position);
+            }
+            this->clusters.build(boxes);
+            this->revision++;
+        }
 
         void clear_heap(){
             for(int i = 0;i < this->vertices.size();i++){
@@ -343,6 +483,19 @@ namespace Obj{
                 }
             }
             this->triangles.clear();
+            this->positions.resize(3, 0);
+            this->clusters = BVH::Tree();
+            this->boundary_edges.clear();
+            this->interior_edges.clear();
+            clear_lods();
+        }
+        void clear_lods(){
+            for(Obj::ObjSet* lod : this->lods){
+                lod->clear_heap();
+                delete lod;
+            }
+            this->lods.clear();
+            this->lod_errors.clear();
         }
     };
 
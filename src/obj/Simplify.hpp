@@ -0,0 +1,385 @@
+#pragma once
+
+#include <queue>
+#include <array>
+
+#include "../global.hpp"
+#include "OBJ.hpp"
+
+namespace Obj{
+    class Simplifier;
+    inline void build_lods(Obj::ObjSet& obj, const int levels, const float crease_angle = 1, const int min_triangles = 64);
+}
+
+
+/*
+quadric error edge-collapse simplification of one ObjSet (Garland and Heckbert)
+
+collapses are half-edge collapses, the removed vertex u lands on its neighbour v,
+so no position, uv or normal is invented and every level samples the source surface
+vertices on boundaries, uv seams, normal seams and smooth group borders are locked,
+a vertex on exactly two crease edges may only slide along its crease line, other crease vertices are locked,
+so outlines of every level follow the creases and borders of the source
+collapses that flip or degenerate a face, or break the manifold link condition, are skipped
+
+the error of a level is the square root of the largest quadric cost collapsed so far,
+roughly the largest distance in world units between the level and the source planes
+*/
+class Obj::Simplifier{
+private:
+    Simplifier(const Simplifier& other);
+    Simplifier& operator=(const Simplifier& other);
+
+    struct Face{
+        std::array<int, 3> v;
+        std::array<std::optional<Eigen::Vector2f>, 3> uv;
+        std::array<std::optional<Eigen::Vector3f>, 3> normal;
+        bool is_smooth;
+        bool alive;
+    };
+    struct Candidate{
+        double cost;
+        int u;
+        int v;
+        uint32_t u_stamp;
+        uint32_t v_stamp;
+        bool operator<(const Candidate& other) const{
+            return cost > other.cost; // std::priority_queue pops the cheapest
+        }
+    };
+    enum Lock: uint8_t{
+        FREE,
+        CREASE, // on a crease line, moves along it only
+        LOCKED
+    };
+
+    std::shared_ptr<Tex::Texture> texture;
+    std::vector<Eigen::Vector3f> position;
+    std::vector<Eigen::Matrix4d> quadric;
+    std::vector<uint8_t> lock;
+    std::vector<uint32_t> stamp;
+    std::vector<bool> removed;
+    std::vector<std::vector<int>> faces_of;
+    std::vector<Face> faces;
+    std::vector<std::vector<int>> creases_of; // crease edges as the other vertex, listed at both ends
+    std::priority_queue<Candidate> heap;
+    int alive;
+    double max_cost;
+
+    static inline Eigen::Matrix4d plane_quadric(const Eigen::Vector3f& normal, const Eigen::Vector3f& point){
+        Eigen::Vector4d plane(normal[0], normal[1], normal[2], -normal.dot(point));
+        return plane * plane.transpose();
+    }
+    inline Eigen::Vector3f face_normal(const Face& face) const{
+        return (position[face.v[1]] - position[face.v[0]]).cross(position[face.v[2]] - position[face.v[0]]);
+    }
+    static inline int corner_of(const Face& face, int vertex){
+        return face.v[0] == vertex ? 0 : (face.v[1] == vertex ? 1 : (face.v[2] == vertex ? 2 : -1));
+    }
+
+    inline double cost(int u, int v) const{
+        Eigen::Vector4d q(position[v][0], position[v][1], position[v][2], 1);
+        return q.dot((quadric[u] + quadric[v]) * q);
+    }
+    inline bool movable(int u, int v) const{
+        if(removed[u] || removed[v] || lock[u] == LOCKED){
+            return false;
+        }
+        return lock[u] == FREE || has_crease(u, v);
+    }
+    inline bool has_crease(int u, int v) const{
+        return std::find(creases_of[u].begin(), creases_of[u].end(), v) != creases_of[u].end();
+    }
+    /*false when the crease edge was already there*/
+    inline bool add_crease(int a, int b){
+        if(has_crease(a, b)){
+            return false;
+        }
+        creases_of[a].push_back(b);
+        creases_of[b].push_back(a);
+        return true;
+    }
+    void push(int u, int v){
+        if(movable(u, v)){
+            heap.push({ cost(u, v), u, v, stamp[u], stamp[v] });
+        }
+    }
+    void neighbours(int vertex, std::vector<int>& result) const{
+        result.clear();
+        for(int f : faces_of[vertex]){
+            for(int c = 0;c < 3;c++){
+                int n = faces[f].v[c];
+                if(n != vertex && std::find(result.begin(), result.end(), n) == result.end()){
+                    result.push_back(n);
+                }
+            }
+        }
+    }
+
+    /*link condition and face flips of moving u onto v*/
+    bool legal(int u, int v) const{
+        int shared = 0;
+        std::vector<int> opposite;
+        for(int f : faces_of[u]){
+            const Face& face = faces[f];
+            if(corner_of(face, v) >= 0){
+                shared++;
+                for(int c = 0;c < 3;c++){
+                    if(face.v[c] != u && face.v[c] != v){
+                        opposite.push_back(face.v[c]);
+                    }
+                }
+                continue;
+            }
+            Eigen::Vector3f before = face_normal(face);
+            Face moved = face;
+            moved.v[corner_of(face, u)] = v;
+            Eigen::Vector3f after = face_normal(moved);
+            float after_norm = after.norm();
+            if(after_norm < 1e-12f || after.dot(before) < 0.2f * after_norm * before.norm()){
+                return false;
+            }
+        }
+        if(shared == 0){
+            return false;
+        }
+        std::vector<int> n_u;
+        std::vector<int> n_v;
+        neighbours(u, n_u);
+        neighbours(v, n_v);
+        for(int n : n_u){
+            if(n != v && std::find(n_v.begin(), n_v.end(), n) != n_v.end() && std::find(opposite.begin(), opposite.end(), n) == opposite.end()){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void collapse(int u, int v){
+        // u is not on a seam, so every face around it is in one uv chart and smoothing group,
+        // corners of v in a face shared with u carry v's attributes in that chart
+        int reference = -1;
+        for(int f : faces_of[u]){
+            if(corner_of(faces[f], v) >= 0){
+                reference = f;
+                break;
+            }
+        }
+        const int ref_corner = corner_of(faces[reference], v);
+        for(int f : faces_of[u]){
+            Face& face = faces[f];
+            if(corner_of(face, v) >= 0){
+                face.alive = false;
+                alive--;
+                for(int w : face.v){
+                    if(w != u && w != v){
+                        std::vector<int>& list = faces_of[w];
+                        list.erase(std::remove(list.begin(), list.end(), f), list.end());
+                    }
+                }
+                continue;
+            }
+            int c = corner_of(face, u);
+            face.v[c] = v;
+            face.uv[c] = faces[reference].uv[ref_corner];
+            face.normal[c] = faces[reference].normal[ref_corner];
+            faces_of[v].push_back(f);
+        }
+        faces_of[u].clear();
+        faces_of[v].erase(std::remove_if(faces_of[v].begin(), faces_of[v].end(), [this](int f){
+            return !faces[f].alive;
+        }), faces_of[v].end());
+
+        if(lock[u] == CREASE){
+            for(int w : creases_of[u]){
+                std::vector<int>& list = creases_of[w];
+                list.erase(std::remove(list.begin(), list.end(), u), list.end());
+                if(w != v){
+                    add_crease(v, w);
+                }
+            }
+            creases_of[u].clear();
+        }
+        quadric[v] += quadric[u];
+        removed[u] = true;
+        stamp[v]++;
+
+        std::vector<int> around;
+        neighbours(v, around);
+        for(int n : around){
+            push(v, n);
+            push(n, v);
+        }
+    }
+
+public:
+    /*`crease_angle` in radians, as Raster::Shader::crease_angle*/
+    Simplifier(const Obj::ObjSet& source, float crease_angle = 1): texture(source.texture), alive(0), max_cost(0){
+        const int n = source.vertices.size();
+        position.resize(n);
+        quadric.assign(n, Eigen::Matrix4d::Zero());
+        lock.assign(n, FREE);
+        stamp.assign(n, 0);
+        removed.assign(n, false);
+        faces_of.resize(n);
+        creases_of.resize(n);
+        for(int i = 0;i < n;i++){
+            position[i] = source.vertices[i]->position;
+        }
+        for(const Obj::Triangle* triangle : source.triangles){
+            Face face;
+            face.v = { triangle->A->index, triangle->B->index, triangle->C->index };
+            face.uv = { triangle->A_texture_uv, triangle->B_texture_uv, triangle->C_texture_uv };
+            face.normal = { triangle->A_normal, triangle->B_normal, triangle->C_normal };
+            face.is_smooth = triangle->is_smooth;
+            face.alive = true;
+            Eigen::Vector3f normal = face_normal(face);
+            if(normal.norm() > 0){
+                Eigen::Matrix4d q = plane_quadric(normal.normalized(), position[face.v[0]]);
+                for(int c = 0;c < 3;c++){
+                    quadric[face.v[c]] += q;
+                }
+            }
+            for(int c = 0;c < 3;c++){
+                faces_of[face.v[c]].push_back(faces.size());
+            }
+            faces.push_back(face);
+        }
+        alive = faces.size();
+
+        // seams: corners of one vertex that disagree
+        for(int i = 0;i < n;i++){
+            const Face* first = nullptr;
+            int first_c = 0;
+            for(int f : faces_of[i]){
+                const Face& face = faces[f];
+                int c = corner_of(face, i);
+                if(!first){
+                    first = &face;
+                    first_c = c;
+                    continue;
+                }
+                bool same_uv = face.uv[c].has_value() == first->uv[first_c].has_value()
+                    && (!face.uv[c].has_value() || (face.uv[c].value() - first->uv[first_c].value()).squaredNorm() < 1e-12f);
+                bool same_normal = !face.is_smooth || (face.normal[c].has_value() == first->normal[first_c].has_value()
+                    && (!face.normal[c].has_value() || (face.normal[c].value() - first->normal[first_c].value()).squaredNorm() < 1e-12f));
+                if(!same_uv || !same_normal || face.is_smooth != first->is_smooth){
+                    lock[i] = LOCKED;
+                    break;
+                }
+            }
+        }
+        // borders, non-manifold edges and creases
+        const float crease_cos = std::cos(crease_angle);
+        for(const Obj::Edge* edge : source.edges){
+            const int a = edge->start->index;
+            const int b = edge->end->index;
+            if(edge->reverse == NULL || edge->reverse->reverse != edge){
+                lock[a] = LOCKED;
+                lock[b] = LOCKED;
+                continue;
+            }
+            if(edge->crease_cos < crease_cos && add_crease(a, b)){
+                // keeps the crease line straight when its vertices slide
+                const Eigen::Vector3f along = edge->end->position - edge->start->position;
+                for(const Obj::Triangle* side : { edge->triangle, edge->reverse->triangle }){
+                    Eigen::Vector3f normal = along.cross(side->face_normal);
+                    if(normal.norm() > 0){
+                        Eigen::Matrix4d q = plane_quadric(normal.normalized(), edge->start->position);
+                        quadric[a] += q;
+                        quadric[b] += q;
+                    }
+                }
+            }
+        }
+        for(int i = 0;i < n;i++){
+            if(lock[i] == FREE && !creases_of[i].empty()){
+                lock[i] = creases_of[i].size() == 2 ? CREASE : LOCKED;
+            }
+        }
+
+        std::vector<int> around;
+        for(int i = 0;i < n;i++){
+            neighbours(i, around);
+            for(int v : around){
+                push(i, v);
+            }
+        }
+    }
+
+    inline int triangle_count() const{
+        return alive;
+    }
+    inline float error() const{
+        return std::sqrt(max_cost);
+    }
+
+    /*collapse the cheapest legal edges until at most `target` triangles remain or none is legal*/
+    int simplify(const int target){
+        while(alive > target && !heap.empty()){
+            Candidate candidate = heap.top();
+            heap.pop();
+            const int u = candidate.u;
+            const int v = candidate.v;
+            if(candidate.u_stamp != stamp[u] || candidate.v_stamp != stamp[v] || !movable(u, v) || !legal(u, v)){
+                continue;
+            }
+            if(candidate.cost > max_cost){
+                max_cost = candidate.cost;
+            }
+            collapse(u, v);
+        }
+        return alive;
+    }
+
+    /*the current level as a new ObjSet on the heap, sharing the source texture*/
+    Obj::ObjSet* extract() const{
+        Obj::ObjSet* result = new Obj::ObjSet(texture);
+        std::vector<Obj::Vertex*> mapped(position.size(), nullptr);
+        for(const Face& face : faces){
+            if(!face.alive){
+                continue;
+            }
+            for(int v : face.v){
+                if(!mapped[v]){
+                    mapped[v] = result->add_vertex(position[v]);
+                }
+            }
+            Obj::Triangle* triangle = result->add_triangle(mapped[face.v[0]], mapped[face.v[1]], mapped[face.v[2]]);
+            triangle->A_texture_uv = face.uv[0];
+            triangle->B_texture_uv = face.uv[1];
+            triangle->C_texture_uv = face.uv[2];
+            triangle->A_normal = face.normal[0];
+            triangle->B_normal = face.normal[1];
+            triangle->C_normal = face.normal[2];
+            triangle->is_smooth = face.is_smooth;
+        }
+        result->build();
+        return result;
+    }
+};
+
+
+/*
+replaces `obj.lods` with up to `levels` coarser meshes from one progressive simplification,
+each level targets half the triangles of the previous one,
+stops early below `min_triangles` or when locked vertices keep a level from shrinking by a sixth
+*/
+inline void Obj::build_lods(Obj::ObjSet& obj, const int levels, const float crease_angle, const int min_triangles){
+    obj.clear_lods();
+    Obj::Simplifier simplifier(obj, crease_angle);
+    int count = obj.triangles.size();
+    for(int level = 0;level < levels;level++){
+        const int target = count / 2;
+        if(target < min_triangles){
+            break;
+        }
+        const int reached = simplifier.simplify(target);
+        if(reached * 6 > count * 5){
+            break;
+        }
+        obj.lods.push_back(simplifier.extract());
+        obj.lod_errors.push_back(simplifier.error());
+        count = reached;
+    }
+}
@@ -1,33 +1,70 @@
 #pragma once
 
+#include <fstream>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
 #include "../global.hpp"
 
 namespace Tex{
     class Texture{
     public:
+        std::string path;
+        uint64_t content_hash;
+        size_t content_size;
         int height;
         int width;
         int channel;
         float* tex;
     private:
         cv::Mat image;
+        mutable std::once_flag load_flag;
+        std::atomic<bool> loaded;
     public:
-        /*used to initialize color texture*/
-        Texture(const std::string& text_path){
-            image = cv::imread(text_path, cv::IMREAD_COLOR);
-            if(image.empty()){
-                throw Manga3DException("Tex: texture image is not opened, " + text_path);
+        /*
+        used to initialize color texture
+        decoding is deferred until the first sampling, or `load()`
+        */
+        Texture(const std::string& text_path, uint64_t content_hash = 0, size_t content_size = 0):
+            path(text_path), content_hash(content_hash), content_size(content_size),
+            height(0), width(0), channel(3), tex(nullptr), loaded(false){}
+
+        Texture(const Texture& other) = delete;
+        Texture& operator=(const Texture& other) = delete;
+
+        void load(){
+            std::call_once(load_flag, [this](){
+                image = cv::imread(path, cv::IMREAD_COLOR);
+                if(image.empty()){
+                    throw Manga3DException("Tex: texture image is not opened, " + path);
+                }
+                cv::cvtColor(image, image, cv::COLOR_BGR2RGB);
+                image.convertTo(image, CV_32FC3, 1.0 / 255.0);
+                this->height = image.rows;
+                this->width = image.cols;
+                this->channel = 3;
+                this->tex = image.ptr<float>(0);
+                loaded.store(true, std::memory_order_release);
+            });
+        }
+        inline bool is_loaded() const{
+            return loaded.load(std::memory_order_acquire);
+        }
+        inline size_t resident_bytes() const{
+            if(!is_loaded()){
+                return 0;
             }
-            cv::cvtColor(image, image, cv::COLOR_BGR2RGB);
-            image.convertTo(image, CV_32FC3, 1.0 / 255.0);
-            this->height = image.rows;
-            this->width = image.cols;
-            this->channel = 3;
-            this->tex = image.ptr<float>(0);
+            return (size_t)width * height * channel * sizeof(float);
         }
 
 
         Eigen::Vector3f bilinear_sampling(float u, float v) const{
+            if(!is_loaded()){
+                const_cast<Texture*>(this)->load();
+            }
             v = 1 - v;
             u *= width;
             v *= height;
@@ -56,4 +93,120 @@ namespace Tex{
             return (1 - low_w) * low + low_w * up;
         }
     };
+
+
+    /*
+    process-wide texture cache, one decoded copy per distinct image
+    textures are keyed by normalized path first, then by content hash,
+    so the same atlas reached through different paths is shared as well
+    */
+    class TextureRegistry{
+    public:
+        struct Stats{
+            size_t hit;
+            size_t miss;
+            size_t textures;
+            size_t decoded;
+            size_t resident_bytes;
+        };
+
+        static TextureRegistry& instance(){
+            static TextureRegistry registry;
+            return registry;
+        }
+
+        std::shared_ptr<Texture> get(const std::string& tex_path){
+            std::string key = std::filesystem::absolute(tex_path).lexically_normal().string();
+            std::lock_guard<std::mutex> lock(mutex);
+            auto path_it = by_path.find(key);
+            if(path_it != by_path.end()){
+                hit++;
+                return path_it->second;
+            }
+
+            std::ifstream file(tex_path, std::ios::binary);
+            if(!file.is_open()){
+                throw Manga3DException("Tex: texture image is not opened, " + tex_path);
+            }
+            uint64_t hash = 14695981039346656037ull; // FNV-1a
+            size_t size = 0;
+            char buffer[1 << 16];
+            while(file){
+                file.read(buffer, sizeof(buffer));
+                std::streamsize n = file.gcount();
+                for(std::streamsize i = 0;i < n;i++){
+                    hash ^= (unsigned char)buffer[i];
+                    hash *= 1099511628211ull;
+                }
+                size += n;
+            }
+            file.close();
+
+            auto hash_it = by_hash.find(hash);
+            if(hash_it != by_hash.end() && hash_it->second->content_size == size){
+                hit++;
+                by_path[key] = hash_it->second;
+                return hash_it->second;
+            }
+            miss++;
+            std::shared_ptr<Texture> texture = std::make_shared<Texture>(tex_path, hash, size);
+            by_path[key] = texture;
+            by_hash[hash] = texture;
+            return texture;
+        }
+
+        Stats stats() const{
+            std::lock_guard<std::mutex> lock(mutex);
+            Stats result = { hit, miss, by_hash.size(), 0, 0 };
+            for(const auto& entry : by_hash){
+                if(entry.second->is_loaded()){
+                    result.decoded++;
+                    result.resident_bytes += entry.second->resident_bytes();
+                }
+            }
+            return result;
+        }
+
+        /*drop textures no longer referenced by any Obj::ObjSet*/
+        void release_unused(){
+            std::lock_guard<std::mutex> lock(mutex);
+            for(auto it = by_hash.begin();it != by_hash.end();){
+                if(it->second.use_count() <= 1 + path_refs(it->second.get())){
+                    for(auto path_it = by_path.begin();path_it != by_path.end();){
+                        if(path_it->second == it->second){
+                            path_it = by_path.erase(path_it);
+                        }
+                        else{
+                            path_it++;
+                        }
+                    }
+                    it = by_hash.erase(it);
+                }
+                else{
+                    it++;
+                }
+            }
+        }
+
+    private:
+        TextureRegistry(): hit(0), miss(0){}
+        TextureRegistry(const TextureRegistry& other) = delete;
+        TextureRegistry& operator=(const TextureRegistry& other) = delete;
+
+        inline long path_refs(const Texture* texture) const{
+            long cnt = 0;
+            for(const auto& entry : by_path){
+                if(entry.second.get() == texture){
+                    cnt++;
+                }
+            }
+            return cnt;
+        }
+
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<Texture>> by_path;
+        std::unordered_map<uint64_t, std::shared_ptr<Texture>> by_hash;
+        size_t hit;
+        size_t miss;
+    };
 }
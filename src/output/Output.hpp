@@ -0,0 +1,501 @@
+#pragma once
+
+#include <fstream>
+#include <cstdint>
+#include <cctype>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include "../global.hpp"
+#include "../Color.hpp"
+#include "../raster/Camera.hpp"
+
+namespace Output{
+    class Image;
+    class QOIEncoder;
+    class AsyncWriter;
+
+    enum class Format{
+        PNG,
+        QOI,
+        PFM // little-endian float, no alpha
+    };
+}
+
+
+/*
+owned copy of a color buffer in Camera::top_buff layout, BGR(A) or gray(+alpha)
+*/
+class Output::Image{
+public:
+    int w;
+    int h;
+    int channel;
+    std::vector<float> data;
+
+    Image(): w(0), h(0), channel(0){}
+    Image(const float* buff, int w, int h, int channel): w(w), h(h), channel(channel), data(buff, buff + (size_t)w * h * channel){}
+    /*from top_buff or the camera's compact color, a depth-only camera has neither*/
+    Image(const Raster::Camera& camera): w(camera.w), h(camera.h), channel((int)camera.bg_color.image_color){
+        if(!camera.top_buff && camera.color_store.empty()){
+            throw Manga3DException("Output::Image(): camera top_buff empty");
+        }
+        data.resize((size_t)w * h * channel);
+        camera.read_color_rows(0, h, data.data());
+    }
+};
+
+
+namespace Output{
+    /*
+    clamp to [0, 1], scale and round, rows are split across threads
+    written as one Eigen array expression so it vectorizes
+    */
+    template<typename T>
+    inline void quantize(const float* src, T* dst, const size_t n, const float scale){
+        const int block = 1 << 16;
+        const int blocks = (n + block - 1) / block;
+        parallel_for(0, blocks, [&](int b_begin, int b_end){
+            size_t begin = (size_t)b_begin * block;
+            size_t end = (size_t)b_end * block < n ? (size_t)b_end * block : n;
+            Eigen::Map<const Eigen::ArrayXf> in(src + begin, end - begin);
+            Eigen::Map<Eigen::Array<T, Eigen::Dynamic, 1>> out(dst + begin, end - begin);
+            out = (in.max(0.0f).min(1.0f) * scale + 0.5f).template cast<T>();
+        });
+    }
+    inline void quantize_8(const float* src, uint8_t* dst, const size_t n){
+        quantize<uint8_t>(src, dst, n, 255.0f);
+    }
+    inline void quantize_16(const float* src, uint16_t* dst, const size_t n){
+        quantize<uint16_t>(src, dst, n, 65535.0f);
+    }
+
+    inline Format format_from_path(const std::string& path){
+        std::string suffix = path.size() >= 4 ? path.substr(path.size() - 4) : "";
+        for(char& c : suffix){
+            c = std::tolower(c);
+        }
+        if(suffix == ".qoi"){
+            return Format::QOI;
+        }
+        if(suffix == ".pfm"){
+            return Format::PFM;
+        }
+        return Format::PNG;
+    }
+}
+
+
+/*
+streaming QOI encoder, pixels can be fed in any number of pieces,
+so images can be written band by band
+*/
+class Output::QOIEncoder{
+private:
+    std::ofstream file;
+    int channel;
+    uint8_t index[64][4];
+    uint8_t prev[4];
+    int run;
+    size_t remaining;
+    std::vector<uint8_t> out;
+
+    inline void flush_run(){
+        if(run > 0){
+            out.push_back(0xc0 | (run - 1));
+            run = 0;
+        }
+    }
+    inline void flush_out(){
+        file.write((const char*)out.data(), out.size());
+        out.clear();
+    }
+    static inline void put_u32(std::vector<uint8_t>& buff, uint32_t v){
+        buff.push_back(v >> 24);
+        buff.push_back(v >> 16);
+        buff.push_back(v >> 8);
+        buff.push_back(v);
+    }
+
+public:
+    /*channel is 3 (RGB) or 4 (RGBA)*/
+    QOIEncoder(const std::string& path, int w, int h, int channel): file(path, std::ios::binary), channel(channel), run(0), remaining((size_t)w * h){
+        if(!file.is_open()){
+            throw Manga3DException("Output::QOIEncoder(): file is not opened, " + path);
+        }
+        if(channel != 3 && channel != 4){
+            throw Manga3DException("Output::QOIEncoder(): channel must be 3 or 4");
+        }
+        std::fill(&index[0][0], &index[0][0] + 64 * 4, 0);
+        prev[0] = prev[1] = prev[2] = 0;
+        prev[3] = 255;
+        out.insert(out.end(), { 'q', 'o', 'i', 'f' });
+        put_u32(out, w);
+        put_u32(out, h);
+        out.push_back(channel);
+        out.push_back(0);
+    }
+    ~QOIEncoder(){
+        if(file.is_open()){
+            try{
+                finish();
+            }
+            catch(...){}
+        }
+    }
+
+    /*n pixels of `channel` interleaved RGB(A) bytes*/
+    void write_pixels(const uint8_t* px, size_t n){
+        if(n > remaining){
+            throw Manga3DException("Output::QOIEncoder::write_pixels(): more pixels than the image holds");
+        }
+        remaining -= n;
+        for(size_t i = 0;i < n;i++, px += channel){
+            uint8_t cur[4] = { px[0], px[1], px[2], channel == 4 ? px[3] : prev[3] };
+            if(cur[0] == prev[0] && cur[1] == prev[1] && cur[2] == prev[2] && cur[3] == prev[3]){
+                run++;
+                if(run == 62){
+                    flush_run();
+                }
+                continue;
+            }
+            flush_run();
+            int hash = (cur[0] * 3 + cur[1] * 5 + cur[2] * 7 + cur[3] * 11) % 64;
+            if(index[hash][0] == cur[0] && index[hash][1] == cur[1] && index[hash][2] == cur[2] && index[hash][3] == cur[3]){
+                out.push_back(hash);
+            }
+            else{
+                std::copy(cur, cur + 4, index[hash]);
+                if(cur[3] == prev[3]){
+                    int8_t dr = cur[0] - prev[0];
+                    int8_t dg = cur[1] - prev[1];
+                    int8_t db = cur[2] - prev[2];
+                    int8_t dr_dg = dr - dg;
+                    int8_t db_dg = db - dg;
+                    if(dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2){
+                        out.push_back(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+                    }
+                    else if(dr_dg > -9 && dr_dg < 8 && dg > -33 && dg < 32 && db_dg > -9 && db_dg < 8){
+                        out.push_back(0x80 | (dg + 32));
+                        out.push_back((dr_dg + 8) << 4 | (db_dg + 8));
+                    }
+                    else{
+                        out.insert(out.end(), { 0xfe, cur[0], cur[1], cur[2] });
+                    }
+                }
+                else{
+                    out.insert(out.end(), { 0xff, cur[0], cur[1], cur[2], cur[3] });
+                }
+            }
+            std::copy(cur, cur + 4, prev);
+        }
+        if(out.size() > (1 << 20)){
+            flush_out();
+        }
+    }
+    void finish(){
+        if(remaining != 0){
+            file.close();
+            throw Manga3DException("Output::QOIEncoder::finish(): image is incomplete");
+        }
+        flush_run();
+        out.insert(out.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+        flush_out();
+        file.close();
+    }
+};
+
+
+namespace Output{
+    /*gray(+alpha) or BGR(A) bytes to interleaved RGB(A) bytes, 3 or 4 channels*/
+    inline void to_rgb8(const uint8_t* src, const int src_ch, uint8_t* dst, const int dst_ch, const size_t n){
+        for(size_t i = 0;i < n;i++, src += src_ch, dst += dst_ch){
+            if(src_ch >= 3){
+                dst[0] = src[2];
+                dst[1] = src[1];
+                dst[2] = src[0];
+            }
+            else{
+                dst[0] = dst[1] = dst[2] = src[0];
+            }
+            if(dst_ch == 4){
+                dst[3] = (src_ch == 4 || src_ch == 2) ? src[src_ch - 1] : 255;
+            }
+        }
+    }
+
+    inline void write_png(const Output::Image& image, const std::string& path, const int bits = 8, const int compression = 3){
+        const size_t n = (size_t)image.w * image.h * image.channel;
+        const int out_ch = image.channel == 2 ? 4 : image.channel;
+        cv::Mat mat;
+        if(bits == 16){
+            std::vector<uint16_t> q(n);
+            quantize_16(image.data.data(), q.data(), n);
+            mat = cv::Mat(image.h, image.w, CV_MAKETYPE(CV_16U, out_ch));
+            uint16_t* dst = mat.ptr<uint16_t>(0);
+            for(size_t i = 0;i < (size_t)image.w * image.h;i++){
+                for(int c = 0;c < out_ch;c++){
+                    dst[i * out_ch + c] = image.channel == 2 ? q[i * 2 + (c == 3 ? 1 : 0)] : q[i * out_ch + c];
+                }
+            }
+        }
+        else{
+            mat = cv::Mat(image.h, image.w, CV_MAKETYPE(CV_8U, out_ch));
+            uint8_t* dst = mat.ptr<uint8_t>(0);
+            if(image.channel == 2){
+                std::vector<uint8_t> q(n);
+                quantize_8(image.data.data(), q.data(), n);
+                for(size_t i = 0;i < (size_t)image.w * image.h;i++){
+                    dst[i * 4] = dst[i * 4 + 1] = dst[i * 4 + 2] = q[i * 2];
+                    dst[i * 4 + 3] = q[i * 2 + 1];
+                }
+            }
+            else{
+                quantize_8(image.data.data(), dst, n);
+            }
+        }
+        if(!cv::imwrite(path, mat, { cv::IMWRITE_PNG_COMPRESSION, compression })){
+            throw Manga3DException("Output::write_png(): failed to write " + path);
+        }
+    }
+
+    /*QOI channels for `channel` floats per pixel, alpha is kept*/
+    inline int qoi_channel(const int channel){
+        return (channel == 2 || channel == 4) ? 4 : 3;
+    }
+    /*`rows` rows of `w` pixels in Camera::top_buff layout appended to `encoder`, made with qoi_channel(channel)*/
+    inline void write_qoi_rows(Output::QOIEncoder& encoder, const float* src, const int w, const int rows, const int channel){
+        const size_t n = (size_t)w * rows;
+        const int out_ch = qoi_channel(channel);
+        std::vector<uint8_t> q(n * channel);
+        quantize_8(src, q.data(), q.size());
+        std::vector<uint8_t> rgb(n * out_ch);
+        parallel_for(0, rows, [&](int y_begin, int y_end){
+            size_t offset = (size_t)y_begin * w;
+            to_rgb8(q.data() + offset * channel, channel, rgb.data() + offset * out_ch, out_ch, (size_t)(y_end - y_begin) * w);
+        }, 16);
+        encoder.write_pixels(rgb.data(), n);
+    }
+
+    inline void write_qoi(const Output::Image& image, const std::string& path){
+        Output::QOIEncoder encoder(path, image.w, image.h, qoi_channel(image.channel));
+        write_qoi_rows(encoder, image.data.data(), image.w, image.h, image.channel);
+        encoder.finish();
+    }
+
+    /*portable float map, bottom-to-top rows of RGB or gray, alpha is dropped*/
+    inline void write_pfm(const Output::Image& image, const std::string& path){
+        std::ofstream file(path, std::ios::binary);
+        if(!file.is_open()){
+            throw Manga3DException("Output::write_pfm(): file is not opened, " + path);
+        }
+        const int out_ch = image.channel >= 3 ? 3 : 1;
+        file << (out_ch == 3 ? "PF" : "Pf") << "\n" << image.w << " " << image.h << "\n-1.0\n";
+        std::vector<float> row((size_t)image.w * out_ch);
+        for(int y = image.h - 1;y >= 0;y--){
+            const float* src = image.data.data() + (size_t)y * image.w * image.channel;
+            for(int x = 0;x < image.w;x++, src += image.channel){
+                if(out_ch == 3){
+                    row[x * 3] = src[2];
+                    row[x * 3 + 1] = src[1];
+                    row[x * 3 + 2] = src[0];
+                }
+                else{
+                    row[x] = src[0];
+                }
+            }
+            file.write((const char*)row.data(), row.size() * sizeof(float));
+        }
+    }
+
+    /*format picked from the suffix, .png (default), .qoi or .pfm*/
+    inline void write(const Output::Image& image, const std::string& path, const int bits = 8){
+        switch(format_from_path(path)){
+        case Format::QOI:
+            write_qoi(image, path);
+            break;
+        case Format::PFM:
+            write_pfm(image, path);
+            break;
+        default:
+            write_png(image, path, bits);
+            break;
+        }
+    }
+    inline void write(const Raster::Camera& camera, const std::string& path, const int bits = 8){
+        write(Output::Image(camera), path, bits);
+    }
+
+    /*one Raster::PixelCost counter of `camera` as a one-channel image of raw counts, for write_pfm()*/
+    inline Output::Image cost_counts(const Raster::Camera& camera, const Raster::PixelCost::Metric metric){
+        if(camera.cost_buff.size() != (size_t)camera.w * camera.h){
+            throw Manga3DException("Output::cost_counts(): camera cost_buff empty, set track_cost before painting");
+        }
+        Output::Image image;
+        image.w = camera.w;
+        image.h = camera.h;
+        image.channel = 1;
+        image.data.resize(camera.cost_buff.size());
+        for(size_t i = 0;i < camera.cost_buff.size();i++){
+            image.data[i] = camera.cost_buff[i].get(metric);
+        }
+        return image;
+    }
+
+    /*
+    false-color BGR view of one counter, black at 0 through blue, red and yellow to white at `max_count`
+    `max_count` 0 scales to the largest count of the frame
+    */
+    inline Output::Image cost_heatmap(const Raster::Camera& camera, const Raster::PixelCost::Metric metric, float max_count = 0){
+        Output::Image counts = cost_counts(camera, metric);
+        if(max_count <= 0){
+            for(float count : counts.data){
+                maximize(max_count, count);
+            }
+        }
+        const float inv = max_count > 0 ? 1.0f / max_count : 0;
+        static const float ramp[5][3] = { { 0, 0, 0 }, { 0.6f, 0, 0 }, { 0, 0, 1 }, { 0, 1, 1 }, { 1, 1, 1 } }; // BGR stops
+        Output::Image image;
+        image.w = counts.w;
+        image.h = counts.h;
+        image.channel = 3;
+        image.data.resize(counts.data.size() * 3);
+        parallel_for(0, counts.data.size(), [&](int i_begin, int i_end){
+            for(int i = i_begin;i < i_end;i++){
+                float t = counts.data[i] * inv * 4;
+                int stop = t >= 4 ? 3 : (int)t;
+                float f = t - stop;
+                if(f > 1){
+                    f = 1;
+                }
+                for(int c = 0;c < 3;c++){
+                    image.data[i * 3 + c] = ramp[stop][c] * (1 - f) + ramp[stop + 1][c] * f;
+                }
+            }
+        }, 4096);
+        return image;
+    }
+
+    /*heatmap path next to the render at `path`, "out/shot.png" gives "out/shot.tested.png" for TESTED*/
+    inline std::string heatmap_path(const std::string& path, const Raster::PixelCost::Metric metric){
+        std::string stem = path;
+        size_t dot = stem.find_last_of('.');
+        if(dot != std::string::npos && stem.find_first_of("/\\", dot) == std::string::npos){
+            stem = stem.substr(0, dot);
+        }
+        return stem + "." + Raster::PixelCost::name(metric) + ".png";
+    }
+    /*a heatmap per Raster::PixelCost counter next to the render at `path`, each scaled to its own maximum*/
+    inline void write_heatmaps(const Raster::Camera& camera, const std::string& path){
+        for(Raster::PixelCost::Metric metric : Raster::PixelCost::metrics){
+            write_png(cost_heatmap(camera, metric), heatmap_path(path, metric));
+        }
+    }
+}
+
+
+/*
+background image writer
+submit() copies the color buffer and returns, so the camera can start the next frame
+while quantizing and encoding happen on the worker threads
+at most `max_pending` images are queued, submit() blocks beyond that
+
+heap data inside
+*/
+class Output::AsyncWriter{
+private:
+    AsyncWriter(const AsyncWriter& other);
+    AsyncWriter& operator=(const AsyncWriter& other);
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable job_ready;
+    std::condition_variable job_done;
+    size_t max_pending;
+    size_t active;
+    bool stopping;
+    std::exception_ptr error;
+
+    void work(){
+        while(true){
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                job_ready.wait(lock, [this](){ return stopping || !jobs.empty(); });
+                if(jobs.empty()){
+                    return;
+                }
+                job = std::move(jobs.front());
+                jobs.pop_front();
+                active++;
+            }
+            job_done.notify_all();
+            try{
+                job();
+            }
+            catch(...){
+                std::lock_guard<std::mutex> lock(mutex);
+                if(!error){
+                    error = std::current_exception();
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                active--;
+            }
+            job_done.notify_all();
+        }
+    }
+
+public:
+    AsyncWriter(int threads = 2, size_t max_pending = 4): max_pending(max_pending), active(0), stopping(false){
+        if(threads < 1){
+            threads = 1;
+        }
+        for(int i = 0;i < threads;i++){
+            workers.emplace_back(&AsyncWriter::work, this);
+        }
+    }
+    ~AsyncWriter(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        job_ready.notify_all();
+        for(std::thread& worker : workers){
+            worker.join();
+        }
+    }
+
+    void submit(std::function<void()> job){
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            job_done.wait(lock, [this](){ return jobs.size() < max_pending; });
+            jobs.push_back(std::move(job));
+        }
+        job_ready.notify_one();
+    }
+    void submit(Output::Image image, const std::string& path, const int bits = 8){
+        std::shared_ptr<Output::Image> owned = std::make_shared<Output::Image>(std::move(image));
+        submit([owned, path, bits](){
+            Output::write(*owned, path, bits);
+        });
+    }
+    inline void submit(const Raster::Camera& camera, const std::string& path, const int bits = 8){
+        submit(Output::Image(camera), path, bits);
+    }
+
+    /*block until every submitted image is written, rethrows the first failure*/
+    void wait(){
+        std::unique_lock<std::mutex> lock(mutex);
+        job_done.wait(lock, [this](){ return jobs.empty() && active == 0; });
+        if(error){
+            std::exception_ptr e = error;
+            error = nullptr;
+            std::rethrow_exception(e);
+        }
+    }
+};
@@ -1,15 +1,31 @@
 #pragma once
 
+#include <unordered_map>
+#include <functional>
+#include <cstring>
+#include <array>
+
 #include "../global.hpp"
 #include "../Color.hpp"
 #include "Shader.hpp"
+#include "Projection.hpp"
+#include "Stats.hpp"
 
 
 
 namespace Raster{
     class Camera;
+    class FeatureLine;
 }
 
+/*a line to stroke, endpoints point into a Raster::ProjectedMesh*/
+class Raster::FeatureLine{
+public:
+    const Eigen::Vector3f* start;
+    const Eigen::Vector3f* end;
+    int thickness;
+};
+
 /*
 heap data inside
 */
@@ -23,6 +39,18 @@ public:
         PERSP,
         FISHEYE
     };
+    /*how top_buff is stored while painting, see `set_formats()`*/
+    enum class ColorFormat{
+        FLOAT, // 4 bytes per channel
+        HALF, // 2 bytes per channel
+        UNORM8 // 1 byte per channel, what 8-bit outputs keep anyway
+    };
+    /*how z_buff is stored while painting, see `set_formats()`*/
+    enum class DepthFormat{
+        FLOAT, // 4 bytes
+        UNORM24, // 3 bytes
+        UNORM16 // 2 bytes
+    };
 
     Projection projection_type;
     Raster::Color bg_color;
@@ -39,6 +67,52 @@ public:
     float* z_buff;
     float* top_buff;
 
+    int msaa; // samples per pixel, 1 disables multisampling
+    float* ms_z_buff; // w * h * msaa
+    float* ms_top_buff; // w * h * msaa * channel, resolved into top_buff by `resolve_msaa()`
+    bool depth_only; // no top_buff or ms_top_buff, for passes that only keep depth such as shadow maps, see `set_depth_only()`
+    ColorFormat color_format = ColorFormat::FLOAT;
+    DepthFormat depth_format = DepthFormat::FLOAT;
+    std::vector<uint8_t> z_store; // w * h depth codes replacing z_buff while depth_format is compact, see `depth_code()`
+    std::vector<uint8_t> color_store; // w * h * channel values replacing top_buff while color_format is compact
+
+    float* normal_buff; // w * h * 3 world face normals, only for screen-space outlines
+    int* id_buff; // w * h, index + 1 of the object covering the pixel, 0 for background
+
+    std::vector<Raster::ProjectedMesh> projected; // one per entry of the obj_set last projected
+
+    Raster::RenderStats stats; // of the last paint(), see Raster::RenderStats
+    bool track_cost = false; // diagnostic, fill `cost_buff` during paint
+    bool front_to_back = false; // paint objects and triangle clusters nearest first, see `paint_order()`
+    float lod_pixel_error = 1; // Obj::ObjSet::lods whose error projects within this many pixels replace the mesh, 0 keeps full detail
+    std::vector<Raster::PixelCost> cost_buff; // w * h, reset by `init_buffs()` while track_cost, empty otherwise
+    bool track_shade = false; // fill `shade_buff` during paint, for Raster::ToneStage
+    std::vector<uint8_t> shade_buff; // w * h Raster::fragment_light() of the front fragment in 1/255 steps, 255 for background, empty unless track_shade
+    Raster::Progress progress; // rasterization progress of paint(), printed to the console when verbose and unset
+    int light_tile = 16; // side in pixels of the screen tiles lights are culled against, 0 evaluates every light at every pixel
+    int buff_tile = 0; // side in pixels of the square blocks z_buff and top_buff are stored in while painting, 0 keeps rows, see `set_buff_tile()`
+    int frame_h = 0; // rows of the whole image when the buffers only hold rows [band_y, band_y + h) of it, 0 paints whole frames, see `set_band()`
+    int band_y = 0;
+
+private:
+    uint64_t config_revision; // bumped by `config()` whenever the projection changes
+    uint64_t projected_revision; // config_revision `projected` was computed with
+    std::vector<std::pair<uint64_t, uint64_t>> projected_meshes; // Obj::ObjSet id and revision per entry of `projected`
+    int layout_tile = 0; // buff_tile the buffers are currently laid out in, set by `init_buffs()` and cleared by `linearize_buffs()`
+    std::vector<std::vector<int>> light_tiles; // Raster::LightSphere indices per light_tile, row major, see `build_light_tiles()`
+    std::vector<std::unordered_map<const Obj::ObjSet*, std::vector<const Obj::Triangle*>>> band_bins; // per band of `paint_bands()`, the triangles it rasterizes
+    int active_band = -1; // entry of band_bins paint() visits, -1 visits every triangle
+    std::vector<std::pair<int, int>> band_spans; // image rows [first, second) the buffers hold per band, with the apron
+    std::vector<std::vector<Raster::FeatureLine>> band_lines; // per band, the feature lines it strokes, see `feature_lines()`
+    std::optional<std::array<float, 4>> band_lines_key; // thickness, crease_thickness, crease_angle and paint_back of band_lines
+    std::optional<std::pair<std::vector<Raster::LightSphere>, bool>> band_tiles_key; // spheres and paint_back light_tiles were built for during paint_bands()
+    bool band_tiled = false;
+    int light_tiles_x;
+    float depth_code_low = -DEFAULT_FAR; // projected depth of the farthest depth code, see `fit_depth_codes()`
+    float depth_code_scale = 1.0f / DEFAULT_FAR; // 1 / the projected depth range the codes span
+
+public:
+
     /*
     buffers are allocated on the heap
     use `delete_buff()` to delete them
@@ -48,15 +122,37 @@ public:
             throw Manga3DException("Raster::Camera::alloc_buff(): illegal w,h");
         }
 
-        if(z_buff){
+        if(z_buff || !z_store.empty()){
             throw Manga3DException("Raster::Camera::alloc_buff(): memory leak z_buff");
         }
-        z_buff = new float[w * h];
+        if(depth_bytes()){
+            z_store.resize((size_t)w * h * depth_bytes());
+        }
+        else{
+            z_buff = new float[w * h];
+        }
 
-        if(top_buff){
+        if(top_buff || !color_store.empty()){
             throw Manga3DException("Raster::Camera::alloc_buff(): memory leak top_buff");
         }
-        top_buff = new float[w * h * (int)bg_color.image_color];
+        if(!depth_only){
+            if(color_bytes()){
+                color_store.resize((size_t)w * h * color_bytes());
+            }
+            else{
+                top_buff = new float[w * h * (int)bg_color.image_color];
+            }
+        }
+
+        if(msaa > 1){
+            if(ms_z_buff || ms_top_buff){
+                throw Manga3DException("Raster::Camera::alloc_buff(): memory leak ms_z_buff or ms_top_buff");
+            }
+            ms_z_buff = new float[w * h * msaa];
+            if(!depth_only){
+                ms_top_buff = new float[w * h * msaa * (int)bg_color.image_color];
+            }
+        }
     }
     inline void delete_buff(){
         if(z_buff){
@@ -65,13 +161,42 @@ public:
         if(top_buff){
             delete[] top_buff;
         }
+        if(ms_z_buff){
+            delete[] ms_z_buff;
+        }
+        if(ms_top_buff){
+            delete[] ms_top_buff;
+        }
+        if(normal_buff){
+            delete[] normal_buff;
+        }
+        if(id_buff){
+            delete[] id_buff;
+        }
+        std::vector<uint8_t>().swap(z_store);
+        std::vector<uint8_t>().swap(color_store);
         clear_buff();
     }
     inline void clear_buff(){
         z_buff = nullptr;
         top_buff = nullptr;
+        ms_z_buff = nullptr;
+        ms_top_buff = nullptr;
+        normal_buff = nullptr;
+        id_buff = nullptr;
     }
-    Camera(Raster::Color bg_color, int w, int h): bg_color(bg_color), w(w), h(h){
+    /*normal_buff and id_buff are allocated on first use, and freed with the other buffers*/
+    inline void init_gbuffs(){
+        if(!normal_buff){
+            normal_buff = new float[w * h * 3];
+        }
+        if(!id_buff){
+            id_buff = new int[w * h];
+        }
+        std::fill(normal_buff, normal_buff + w * h * 3, 0.0f);
+        std::fill(id_buff, id_buff + w * h, 0);
+    }
+    Camera(Raster::Color bg_color, int w, int h): projection_type(Projection::ORTHO), bg_color(bg_color), w(w), h(h), msaa(1), depth_only(false), config_revision(1), projected_revision(0){
         clear_buff();
         alloc_buff();
     }
@@ -81,19 +206,225 @@ public:
 
     void init_buffs(){ //bg_color[1] => green => BLACKWHITE
         int wh = w * h;
-        float* z_buff_t = z_buff;
-        float* top_buff_t = top_buff;
-        for(int i = 0;i < wh;i++){
-            *z_buff_t = -MAX_F;
-            z_buff_t++;
-            color_assign(bg_color, top_buff_t);
-            top_buff_t += (int)bg_color.image_color;
+        if(track_cost){
+            cost_buff.assign(wh, Raster::PixelCost());
+        }
+        else if(!cost_buff.empty()){
+            std::vector<Raster::PixelCost>().swap(cost_buff);
+        }
+        if(track_shade){
+            shade_buff.assign(wh, 255);
+        }
+        else if(!shade_buff.empty()){
+            std::vector<uint8_t>().swap(shade_buff);
+        }
+        layout_tile = buff_tile;
+        if(depth_bytes() && z_buff){ // expanded by `expand_buffs()` for the last frame's post stages
+            delete[] z_buff;
+            z_buff = nullptr;
+            z_store.resize((size_t)wh * depth_bytes());
+        }
+        if(color_bytes() && top_buff){
+            delete[] top_buff;
+            top_buff = nullptr;
+            color_store.resize((size_t)wh * color_bytes());
+        }
+        if(z_buff){
+            std::fill(z_buff, z_buff + wh, -MAX_F);
+        }
+        std::fill(z_store.begin(), z_store.end(), 0);
+        fill_bg(top_buff, wh);
+        if(!color_store.empty()){
+            const int ch = (int)bg_color.image_color;
+            float pattern[4];
+            color_assign(bg_color, pattern);
+            store_color(0, pattern, ch);
+            for(size_t filled = color_bytes();filled < color_store.size();filled *= 2){ // doubling copies of the filled prefix
+                std::copy(color_store.begin(), color_store.begin() + std::min(filled, color_store.size() - filled), color_store.begin() + filled);
+            }
+        }
+        if(msaa > 1){
+            std::fill(ms_z_buff, ms_z_buff + wh * msaa, -MAX_F);
+            fill_bg(ms_top_buff, wh * msaa);
+        }
+    }
+    /*`pixels` entries of bg_color into `buff`, nothing for the missing color buffers of a depth_only camera*/
+    inline void fill_bg(float* buff, const int pixels) const{
+        if(!buff){
+            return;
+        }
+        const int ch = (int)bg_color.image_color;
+        if(ch == 1){
+            std::fill(buff, buff + pixels, bg_color.color[0]);
+            return;
+        }
+        float pattern[4];
+        color_assign(bg_color, pattern);
+        for(int i = 0;i < pixels;i++){
+            for(int c = 0;c < ch;c++){
+                buff[i * ch + c] = pattern[c];
+            }
+        }
+    }
+    /*
+    0 stores pixels row by row, a power of two from 4 to 64 stores them in square blocks while painting,
+    so a triangle's bounding box touches fewer cache lines and the 64-row line bands never share one
+    colored cameras are turned back to rows at the end of paint, depth-only ones keep the blocks for their lookups
+    */
+    void set_buff_tile(int pixels){
+        if(pixels != 0 && (pixels < 4 || pixels > 64 || (pixels & (pixels - 1)))){
+            throw Manga3DException("Raster::Camera::set_buff_tile(): pixels must be 0 or a power of two from 4 to 64");
+        }
+        buff_tile = pixels;
+    }
+    /*
+    the buffers hold rows [y, y + h) of a `frame_h` tall image, h being config()'s height, 0 frame_h goes back to whole frames
+    projections stay in rows of the whole image, so bands line up and moving to another band keeps `projected`,
+    paint() and the line drawing subtract band_y where they index the buffers
+    */
+    void set_band(int frame_h, int y){
+        if(frame_h < 0 || y < 0 || (frame_h && y >= frame_h)){
+            throw Manga3DException("Raster::Camera::set_band(): y must lie inside frame_h");
+        }
+        if(frame_h != this->frame_h){ // the viewports follow frame_h instead of h
+            ortho_matrix_cache.reset();
+            fisheyeviewport_matrix_cache.reset();
+        }
+        this->frame_h = frame_h;
+        this->band_y = frame_h ? y : 0;
+    }
+    /*
+    drop or restore the color buffers, shaders still run but their color is discarded
+    shadow map cameras only keep depth, which saves w * h * channel floats per light
+    */
+    void set_depth_only(bool enable){
+        if(enable == depth_only){
+            return;
+        }
+        if(enable && depth_format != DepthFormat::FLOAT){
+            throw Manga3DException("Raster::Camera::set_depth_only(): depth-only cameras are looked up through z_buff, depth_format must be FLOAT");
+        }
+        delete_buff();
+        depth_only = enable;
+        alloc_buff();
+    }
+    /*
+    compact storage for painting, 8-bit or half color and 24 or 16-bit depth instead of floats
+    shaders still run on floats, their fragment is converted where it is written,
+    `expand_buffs()` turns the buffers back into float top_buff and z_buff for post stages,
+    outputs read the compact color directly through `read_color_rows()`
+    depth codes span the projected depth of the frame's meshes, see `fit_depth_codes()`
+    */
+    void set_formats(ColorFormat color, DepthFormat depth){
+        if(depth_only && depth != DepthFormat::FLOAT){
+            throw Manga3DException("Raster::Camera::set_formats(): depth-only cameras are looked up through z_buff, depth must be FLOAT");
+        }
+        if(color == color_format && depth == depth_format){
+            return;
+        }
+        delete_buff();
+        color_format = color;
+        depth_format = depth;
+        alloc_buff();
+    }
+    /*bytes per pixel of z_store, 0 for float depth*/
+    inline int depth_bytes() const{
+        switch(depth_format){
+        case DepthFormat::UNORM24:
+            return 3;
+        case DepthFormat::UNORM16:
+            return 2;
+        default:
+            return 0;
+        }
+    }
+    /*bytes per pixel of color_store, 0 for float color*/
+    inline int color_bytes() const{
+        switch(color_format){
+        case ColorFormat::HALF:
+            return 2 * (int)bg_color.image_color;
+        case ColorFormat::UNORM8:
+            return (int)bg_color.image_color;
+        default:
+            return 0;
+        }
+    }
+    /*the buffers are in a compact format, paint() then goes through `depth_test()` and `store_color()`*/
+    inline bool compact() const{
+        return !z_store.empty() || !color_store.empty();
+    }
+
+    /*
+    samples per pixel, 1, 2, 4 or 8
+    coverage and depth are kept per sample, shading runs once per pixel per triangle
+    */
+    void set_msaa(int samples){
+        if(samples != 1 && samples != 2 && samples != 4 && samples != 8){
+            throw Manga3DException("Raster::Camera::set_msaa(): samples must be 1, 2, 4 or 8");
+        }
+        if(samples == msaa){
+            return;
+        }
+        delete_buff();
+        msaa = samples;
+        alloc_buff();
+    }
+    /*sample offsets from the pixel position, in pixels*/
+    inline const Eigen::Vector2f* msaa_pattern() const{
+        static const Eigen::Vector2f pattern_1[1] = { Eigen::Vector2f(0, 0) };
+        static const Eigen::Vector2f pattern_2[2] = { Eigen::Vector2f(0.25, 0.25), Eigen::Vector2f(-0.25, -0.25) };
+        static const Eigen::Vector2f pattern_4[4] = {
+            Eigen::Vector2f(-0.125, -0.375), Eigen::Vector2f(0.375, -0.125),
+            Eigen::Vector2f(-0.375, 0.125), Eigen::Vector2f(0.125, 0.375) };
+        static const Eigen::Vector2f pattern_8[8] = {
+            Eigen::Vector2f(0.0625, -0.1875), Eigen::Vector2f(-0.0625, 0.1875),
+            Eigen::Vector2f(0.3125, 0.0625), Eigen::Vector2f(-0.1875, -0.3125),
+            Eigen::Vector2f(-0.3125, 0.3125), Eigen::Vector2f(-0.4375, -0.0625),
+            Eigen::Vector2f(0.1875, 0.4375), Eigen::Vector2f(0.4375, -0.4375) };
+        switch(msaa){
+        case 2:
+            return pattern_2;
+        case 4:
+            return pattern_4;
+        case 8:
+            return pattern_8;
+        default:
+            return pattern_1;
         }
     }
+    /*average samples into top_buff, nearest sample depth into z_buff, or their compact stores*/
+    void resolve_msaa(){
+        if(msaa <= 1){
+            return;
+        }
+        const int ch = (int)bg_color.image_color;
+        const float inv = 1.0f / msaa;
+        parallel_for(0, h, [&](int y_begin, int y_end){
+            for(int i = y_begin * w;i < y_end * w;i++){
+                if(!depth_only){
+                    const float* samples = ms_top_buff + i * msaa * ch;
+                    float pixel[4];
+                    for(int c = 0;c < ch;c++){
+                        float sum = 0;
+                        for(int s = 0;s < msaa;s++){
+                            sum += samples[s * ch + c];
+                        }
+                        pixel[c] = sum * inv;
+                    }
+                    store_color(i, pixel, ch);
+                }
+                float z = -MAX_F;
+                for(int s = 0;s < msaa;s++){
+                    maximize(z, ms_z_buff[i * msaa + s]);
+                }
+                store_depth(i, z);
+            }
+        }, 16);
+    }
 
     template<typename T>
     inline T* get_buff(Eigen::Vector3f ind, T* buff, int channel) const{
-        if(top_buff == NULL || ind[2] > 0){
+        if(buff == NULL || ind[2] > 0){
             return nullptr;
         }
         return get_buff<T>((int)ind[0], (int)ind[1], buff, channel);
@@ -105,9 +436,70 @@ public:
         }
         return get_buff_trust<T>(x, y, buff, channel);
     }
+    /*
+    element index of pixel (x, y) in a one-channel buffer
+    in the tiled layout each row of blocks spans the same elements as its rows, blocks at the right and bottom edges are narrower
+    */
+    inline int pixel_index(int x, int y) const{
+        if(!layout_tile){
+            return x + y * this->w;
+        }
+        const int x0 = x & -layout_tile;
+        const int y0 = y & -layout_tile;
+        const int tile_w = std::min(layout_tile, this->w - x0);
+        const int tile_h = std::min(layout_tile, this->h - y0);
+        return y0 * this->w + x0 * tile_h + (y - y0) * tile_w + (x - x0);
+    }
+    /*
+    z_buff, top_buff and the screen outline buffers back to rows after painting in the tiled layout
+    so post stages and outputs can index x + y * w, depth-only cameras keep their blocks
+    */
+    void linearize_buffs(const bool gbuffs){
+        if(!layout_tile || depth_only){
+            return;
+        }
+        if(z_buff){
+            linearize(z_buff, 1);
+        }
+        else{
+            linearize(z_store.data(), depth_bytes());
+        }
+        if(top_buff){
+            linearize(top_buff, (int)bg_color.image_color);
+        }
+        else{
+            linearize(color_store.data(), color_bytes());
+        }
+        if(gbuffs){
+            linearize(id_buff, 1);
+            linearize(normal_buff, 3);
+        }
+        layout_tile = 0;
+    }
+    /*one row of blocks at a time, in place through a copy of the row*/
+    template<typename T>
+    void linearize(T* buff, const int channel) const{
+        const int t = layout_tile;
+        parallel_for(0, (this->h + t - 1) / t, [&](int ty_begin, int ty_end){
+            std::vector<T> blocks;
+            for(int ty = ty_begin;ty < ty_end;ty++){
+                const int y0 = ty * t;
+                const int tile_h = std::min(t, this->h - y0);
+                T* rows = buff + y0 * this->w * channel;
+                blocks.assign(rows, rows + tile_h * this->w * channel);
+                for(int x0 = 0;x0 < this->w;x0 += t){
+                    const int span = std::min(t, this->w - x0) * channel;
+                    const T* block = blocks.data() + x0 * tile_h * channel;
+                    for(int y = 0;y < tile_h;y++){
+                        std::copy(block + y * span, block + (y + 1) * span, rows + (y * this->w + x0) * channel);
+                    }
+                }
+            }
+        }, 1);
+    }
     template<typename T>
     inline T* get_buff_trust(int x, int y, T* buff, int channel) const{
-        int index = x + y * this->w;
+        int index = pixel_index(x, y);
         if(channel > 1){
             index *= channel;
         }
@@ -132,6 +524,170 @@ public:
         return get_buff_trust<float>(x, y, this->z_buff, 1);
     }
 
+    /*
+    code of projected depth `z` in depth_format, larger is closer like z and 0 is left for the background,
+    codes are spaced evenly in projected depth, so PERSP keeps more of them near the camera like a float z_buff
+    */
+    inline uint32_t depth_code(const float z) const{
+        if(z <= -MAX_F){
+            return 0;
+        }
+        const uint32_t top = depth_format == DepthFormat::UNORM16 ? 0xFFFF : 0xFFFFFF;
+        const float t = (z - depth_code_low) * depth_code_scale;
+        return 1 + (uint32_t)((top - 1) * std::min(std::max(t, 0.0f), 1.0f) + 0.5f);
+    }
+    /*projected depth of a code from `depth_code()`*/
+    inline float depth_from_code(const uint32_t code) const{
+        if(!code){
+            return -MAX_F;
+        }
+        const uint32_t top = depth_format == DepthFormat::UNORM16 ? 0xFFFF : 0xFFFFFF;
+        return depth_code_low + (float)(code - 1) / (top - 1) / depth_code_scale;
+    }
+    /*
+    spreads the depth codes over the projected depth of the vertices in front of the camera rather than from near to far,
+    fragments and lines lie between their vertices so they stay in range, run by paint() after projecting
+    */
+    void fit_depth_codes(){
+        float low = MAX_F;
+        float high = -MAX_F;
+        for(const Raster::ProjectedMesh& mesh : this->projected){
+            for(const Eigen::Vector3f& p : mesh.positions){
+                if(p[2] <= 0){
+                    minimize(low, p[2]);
+                    maximize(high, p[2]);
+                }
+            }
+        }
+        if(low > high){
+            low = -this->far;
+            high = 0;
+        }
+        depth_code_low = low;
+        depth_code_scale = high > low ? 1 / (high - low) : 1;
+    }
+    inline uint32_t load_depth_code(const int index) const{
+        const uint8_t* p = &z_store[(size_t)index * depth_bytes()];
+        uint32_t code = p[0] | (uint32_t)p[1] << 8;
+        if(depth_format == DepthFormat::UNORM24){
+            code |= (uint32_t)p[2] << 16;
+        }
+        return code;
+    }
+    inline void store_depth_code(const int index, const uint32_t code){
+        uint8_t* p = &z_store[(size_t)index * depth_bytes()];
+        p[0] = code & 0xFF;
+        p[1] = (code >> 8) & 0xFF;
+        if(depth_format == DepthFormat::UNORM24){
+            p[2] = (code >> 16) & 0xFF;
+        }
+    }
+    /*`z` passes the depth test at pixel `index` of z_buff or z_store, equal depth passes as in Raster::Shader::shade()*/
+    inline bool depth_test(const int index, const float z) const{
+        if(z_store.empty()){
+            return z >= z_buff[index];
+        }
+        return depth_code(z) >= load_depth_code(index);
+    }
+    inline void store_depth(const int index, const float z){
+        if(z_store.empty()){
+            z_buff[index] = z;
+        }
+        else{
+            store_depth_code(index, depth_code(z));
+        }
+    }
+    /*the first `count` channels of pixel `index` in top_buff or color_store*/
+    inline void store_color(const int index, const float* color, const int count){
+        switch(color_format){
+        case ColorFormat::HALF:{
+            uint8_t* p = &color_store[(size_t)index * color_bytes()];
+            for(int c = 0;c < count;c++){
+                const Eigen::half value(color[c]);
+                std::memcpy(p + c * 2, &value, 2);
+            }
+            break;
+        }
+        case ColorFormat::UNORM8:{
+            uint8_t* p = &color_store[(size_t)index * color_bytes()];
+            for(int c = 0;c < count;c++){
+                p[c] = (uint8_t)(std::min(std::max(color[c], 0.0f), 1.0f) * 255 + 0.5f);
+            }
+            break;
+        }
+        default:
+            std::copy(color, color + count, top_buff + index * (int)bg_color.image_color);
+        }
+    }
+    inline void load_color(const int index, float* color) const{
+        const int ch = (int)bg_color.image_color;
+        switch(color_format){
+        case ColorFormat::HALF:{
+            const uint8_t* p = &color_store[(size_t)index * color_bytes()];
+            for(int c = 0;c < ch;c++){
+                Eigen::half value;
+                std::memcpy(&value, p + c * 2, 2);
+                color[c] = (float)value;
+            }
+            break;
+        }
+        case ColorFormat::UNORM8:{
+            const uint8_t* p = &color_store[(size_t)index * color_bytes()];
+            for(int c = 0;c < ch;c++){
+                color[c] = p[c] * (1.0f / 255);
+            }
+            break;
+        }
+        default:
+            std::copy(top_buff + index * ch, top_buff + (index + 1) * ch, color);
+        }
+    }
+    /*
+    image rows [y, y + rows) as floats in top_buff layout, from top_buff or the compact color_store,
+    the buffers must be back in rows, which paint() leaves them in
+    */
+    void read_color_rows(const int y, const int rows, float* dst) const{
+        if(y < 0 || rows < 0 || y + rows > this->h){
+            throw Manga3DException("Raster::Camera::read_color_rows(): rows outside the buffers");
+        }
+        const int ch = (int)bg_color.image_color;
+        if(top_buff){
+            std::copy(top_buff + (size_t)y * this->w * ch, top_buff + (size_t)(y + rows) * this->w * ch, dst);
+            return;
+        }
+        if(color_store.empty()){
+            throw Manga3DException("Raster::Camera::read_color_rows(): no color buffer");
+        }
+        parallel_for(y, y + rows, [&](int y_begin, int y_end){
+            for(int i = y_begin * this->w;i < y_end * this->w;i++){
+                load_color(i, dst + (size_t)(i - y * this->w) * ch);
+            }
+        }, 16);
+    }
+    /*
+    compact buffers back to float z_buff and top_buff for the post stages, which read and swap them in place,
+    the next `init_buffs()` returns to the compact formats, nothing happens when the buffers are float already
+    */
+    void expand_buffs(){
+        const int wh = this->w * this->h;
+        if(!z_store.empty()){
+            float* depth = new float[wh];
+            parallel_for(0, this->h, [&](int y_begin, int y_end){
+                for(int i = y_begin * this->w;i < y_end * this->w;i++){
+                    depth[i] = depth_from_code(load_depth_code(i));
+                }
+            }, 16);
+            z_buff = depth;
+            std::vector<uint8_t>().swap(z_store);
+        }
+        if(!color_store.empty()){
+            float* color = new float[(size_t)wh * (int)bg_color.image_color];
+            read_color_rows(0, this->h, color);
+            top_buff = color;
+            std::vector<uint8_t>().swap(color_store);
+        }
+    }
+
 private:
     std::optional<Eigen::Matrix4f> movecamera_matrix_cache; //position
     std::optional<Eigen::Matrix4f> rotatecamera_matrix_cache; //lookat_g
@@ -146,8 +702,12 @@ private:
 
 public:
     void config(Projection projection_type, Raster::Color& bg_color, int w, int h, float fovY, Eigen::Vector3f& position, Eigen::Vector3f& lookat_g, float up_t = 0, float near = DEFAULT_NEAR, float far = DEFAULT_FAR){
+        bool projection_changed = (projection_type != this->projection_type);
         this->projection_type = projection_type;
-        if(this->bg_color.image_color != bg_color.image_color || this->w != w || this->h != h){
+        const bool size_changed = (this->w != w || this->h != h);
+        const bool viewport_changed = (this->w != w || (!frame_h && this->h != h)); // the viewports below follow w and h, which are stored here already
+        const bool fov_changed = !equal(fovY, this->fovY); // every block below reads it, this->fovY is stored after them
+        if(this->bg_color.image_color != bg_color.image_color || size_changed){
             delete_buff();
             this->bg_color = bg_color;
             this->w = w;
@@ -216,13 +776,12 @@ public:
 
         //update ortho_matrix_cache
         bool ortho_changed = false;
-        if(!ortho_matrix_cache || w != this->w || h != this->h || !equal(fovY, this->fovY)){
+        if(!ortho_matrix_cache || viewport_changed || fov_changed){
             this->w = w;
             this->h = h;
-            this->fovY = fovY;
             Eigen::Matrix4f ViewPort;
             float half_w = w * 0.5;
-            float half_h = h * 0.5;
+            float half_h = (frame_h ? frame_h : h) * 0.5;
             float scale = half_w / std::tan(fovY * 0.5);
             ViewPort << scale, 0, 0, half_w,
                 0, -scale, 0, half_h,
@@ -237,12 +796,11 @@ public:
 
         //update persp_matrix_cache
         bool persp_changed = false;
-        if(!persp_matrix_cache || !equal(near, this->near) || !equal(far, this->far)){
+        if(!persp_matrix_cache || fov_changed || !equal(near, this->near) || !equal(far, this->far)){
             this->near = near;
             this->far = far;
             this->w = w;
             this->h = h;
-            this->fovY = fovY;
             Eigen::Matrix4f Proj;
             float half_w = w * 0.5;
             float half_h = h * 0.5;
@@ -259,14 +817,15 @@ public:
         }
 
         //update fisheyeviewport_matrix_cache
-        if(!fisheyeviewport_matrix_cache || w != this->w || h != this->h || !equal(fovY, this->fovY)){
+        bool fisheye_changed = false;
+        if(!fisheyeviewport_matrix_cache || viewport_changed || fov_changed){
+            fisheye_changed = true;
             this->w = w;
             this->h = h;
-            this->fovY = fovY;
             Eigen::Matrix4f Scale;
             float p = fovY * 0.5;
             float half_w = w * 0.5;
-            float half_h = h * 0.5;
+            float half_h = (frame_h ? frame_h : h) * 0.5;
             float scale = half_h / std::sin(p);
             Scale << (scale), 0, 0, half_w,
                 0, (-scale), 0, half_h,
@@ -274,7 +833,28 @@ public:
                 0, 0, 0, 1;
             fisheyeviewport_matrix_cache = Scale;
         }
+        this->fovY = fovY;
 
+        if(projection_changed || viewport_changed || putcamera_changed || ortho_changed || persp_changed || fisheye_changed){
+            this->config_revision++;
+        }
+    }
+
+    /*distance along the view direction for a projected depth, larger is farther*/
+    inline float linear_depth(const float z) const{
+        if(this->projection_type == Projection::PERSP){
+            return this->near * this->far / (z + this->near + this->far);
+        }
+        return -z;
+    }
+
+    /*the matrix projection() applies before the perspective divide, ORTHO and PERSP only as FISHEYE is not linear*/
+    const Eigen::Matrix4f& clip_matrix() const{
+        const std::optional<Eigen::Matrix4f>& matrix = this->projection_type == Projection::PERSP ? persp_cache : ortho_cache;
+        if(this->projection_type == Projection::FISHEYE || !matrix){
+            throw Manga3DException("Raster::Camera::clip_matrix(): no linear projection configured");
+        }
+        return matrix.value();
     }
 
     void projection(Eigen::Vector3f& point_position) const{
@@ -318,37 +898,193 @@ public:
         point_position = point_position_h.hnormalized();
     }
 
+    /*
+    batched `projection()`: projects every column of `src` into `dst`
+    the matrices are resolved once, columns are transformed in cache-sized blocks
+    as whole-matrix Eigen expressions (vectorized, AVX2 when built with -mavx2),
+    and blocks are spread over parallel_for
+    `model` is folded into the first matrix, so instances cost the same as world-space meshes
+    */
+    void project_points(const Eigen::Matrix3Xf& src, Eigen::Vector3f* dst, const Eigen::Matrix4f* model = nullptr) const{
+        const int n = src.cols();
+        if(n == 0){
+            return;
+        }
+        const Eigen::Matrix4f* first;
+        const Eigen::Matrix4f* second = nullptr;
+        const char* missing = nullptr;
+        switch(this->projection_type){
+        case Projection::ORTHO:
+            first = ortho_cache ? &ortho_cache.value() : nullptr;
+            missing = "ortho_cache";
+            break;
+        case Projection::PERSP:
+            first = persp_cache ? &persp_cache.value() : nullptr;
+            missing = "persp_cache";
+            break;
+        default: // FISHEYE
+            first = putcamera_matrix_cache ? &putcamera_matrix_cache.value() : nullptr;
+            second = fisheyeviewport_matrix_cache ? &fisheyeviewport_matrix_cache.value() : nullptr;
+            missing = "putcamera_matrix_cache or fisheyeviewport_matrix_cache";
+            if(!second){
+                first = nullptr;
+            }
+            break;
+        }
+        if(!first){
+            throw Manga3DException(std::string("Raster::Camera::project_points(): ") + missing + " empty");
+        }
+        const Eigen::Matrix4f M = model ? Eigen::Matrix4f(*first * *model) : *first;
+        const bool fisheye = (second != nullptr);
+        const Eigen::Matrix4f F = fisheye ? *second : Eigen::Matrix4f::Identity();
+
+        const int block = 2048;
+        const int blocks = (n + block - 1) / block;
+        Eigen::Map<Eigen::Matrix3Xf> out(dst->data(), 3, n);
+        parallel_for(0, blocks, [&](int b_begin, int b_end){
+            Eigen::Matrix<float, 4, Eigen::Dynamic> h(4, block);
+            for(int b = b_begin;b < b_end;b++){
+                const int begin = b * block;
+                const int len = begin + block < n ? block : n - begin;
+                auto h_block = h.leftCols(len);
+                h_block.noalias() = M.leftCols<3>() * src.middleCols(begin, len);
+                h_block.colwise() += M.col(3);
+                if(fisheye){
+                    Eigen::Array<float, 1, Eigen::Dynamic> w_inv = h_block.row(3).array().inverse();
+                    Eigen::Array<float, 1, Eigen::Dynamic> dist_i = ((h_block.topRows<3>().array().rowwise() * w_inv).matrix().colwise().norm().array()).inverse();
+                    h_block.row(0).array() *= dist_i;
+                    h_block.row(1).array() *= dist_i;
+                    h_block = F * h_block;
+                }
+                out.middleCols(begin, len) = h_block.colwise().hnormalized();
+            }
+        }, 1);
+    }
+
+
 
 
 
 
 
 
+    /*true when `projected` already holds this camera's current view of `obj_set`*/
+    bool is_projection_current(const std::vector<Obj::ObjSet*>& obj_set) const{
+        if(this->projected_revision != this->config_revision || this->projected_meshes.size() != obj_set.size()){
+            return false;
+        }
+        for(int o = 0;o < (int)obj_set.size();o++){
+            if(this->projected_meshes[o].first != obj_set[o]->id || this->projected_meshes[o].second != obj_set[o]->world_revision()){
+                return false;
+            }
+        }
+        return true;
+    }
 
+    /*
+    fills `projected` with this camera's view of every object, vertex positions and triangle normals
+    the meshes themselves are only read, so cameras can project the same objects concurrently
+    skipped when neither the camera nor the meshes changed since the last call,
+    code editing Vertex::position directly must bump Obj::ObjSet::revision
+    instances are projected from their shared mesh through their model matrix
+    */
     void project_vertices(const std::vector<Obj::ObjSet*>& obj_set, const bool verbose){
-        for(Obj::ObjSet* obj : obj_set){
-            int i = 0;
-            for(Obj::Vertex* vertex : obj->vertices){
-                vertex->projected_position = vertex->position;
-                this->projection(vertex->projected_position);
-                if(verbose){
-                    i++;
-                    if(i % 100 == 0 || i == obj->vertices.size()){
-                        print_progress(i, obj->vertices.size(), "Project vertex");
-                    }
-                }
+        if(is_projection_current(obj_set)){
+            if(verbose){
+                std::cout << "Projection reused" << std::endl;
             }
+            return;
+        }
+        this->projected.resize(obj_set.size());
+        this->projected_meshes.resize(obj_set.size());
+        for(int o = 0;o < (int)obj_set.size();o++){
+            const Obj::ObjSet* obj = obj_set[o];
+            const Obj::ObjSet& geometry = obj->geometry();
+            Raster::ProjectedMesh& mesh = this->projected[o];
+            mesh.positions.resize(geometry.vertices.size());
+            project_points(geometry.positions, mesh.positions.data(), obj->is_instance() ? &obj->model : nullptr);
+            mesh.calculate_normals(&geometry);
+            this->projected_meshes[o] = std::make_pair(obj->id, obj->world_revision());
             if(verbose){
-                std::cout << std::endl;
+                std::cout << "Project vertex: " << geometry.vertices.size() << ", triangle normal: " << geometry.triangles.size() << std::endl;
             }
         }
+        this->projected_revision = this->config_revision;
         if(verbose){
             std::cout << "End project vertex" << std::endl;
         }
     }
 
 
-    void paint_line_simple(const Eigen::Vector3f& a, const Eigen::Vector3f& b, const Raster::Color& color, const int thickness){
+    /*
+    pixel offsets covered around each step of a line of `thickness`,
+    1 to 3 are the classic 1, 2x2 and 4x4-without-corners stamps, thicker lines use discs
+    */
+    static const std::vector<Eigen::Vector2i>& line_stamp(int thickness){
+        static const int max_thickness = 16;
+        static const std::vector<std::vector<Eigen::Vector2i>> stamps = [](){
+            std::vector<std::vector<Eigen::Vector2i>> result(max_thickness + 1);
+            result[0] = { Eigen::Vector2i(0, 0) };
+            result[1] = result[0];
+            result[2] = { Eigen::Vector2i(0, 0), Eigen::Vector2i(1, 0), Eigen::Vector2i(0, 1), Eigen::Vector2i(1, 1) };
+            result[3] = result[2];
+            result[3].insert(result[3].end(), {
+                Eigen::Vector2i(-1, 0), Eigen::Vector2i(-1, 1), Eigen::Vector2i(0, -1), Eigen::Vector2i(1, -1),
+                Eigen::Vector2i(2, 0), Eigen::Vector2i(2, 1), Eigen::Vector2i(0, 2), Eigen::Vector2i(1, 2) });
+            for(int t = 4;t <= max_thickness;t++){
+                float r = t * 0.5f;
+                for(int dy = -t / 2;dy <= t / 2 + 1;dy++){
+                    for(int dx = -t / 2;dx <= t / 2 + 1;dx++){
+                        if((dx - 0.5f) * (dx - 0.5f) + (dy - 0.5f) * (dy - 0.5f) <= r * r){
+                            result[t].push_back(Eigen::Vector2i(dx, dy));
+                        }
+                    }
+                }
+            }
+            return result;
+        }();
+        if(thickness < 0){
+            thickness = 0;
+        }
+        else if(thickness > max_thickness){
+            thickness = max_thickness;
+        }
+        return stamps[thickness];
+    }
+
+    /*depth-tested write of one line pixel, `index` from pixel_index(), `cost_index` the row-major x + (y - band_y) * w of cost_buff*/
+    inline void plot_line_pixel(const int index, const int cost_index, const float z, const float* color, const int color_ch){
+        if(!cost_buff.empty()){
+            cost_buff[cost_index].line_stamps++;
+        }
+        if(msaa > 1){
+            const int ch = (int)bg_color.image_color;
+            const int sample = index * msaa;
+            for(int s = 0;s < msaa;s++){
+                if(no_less_than(z, ms_z_buff[sample + s])){
+                    ms_z_buff[sample + s] = z;
+                    if(!depth_only){
+                        std::copy(color, color + color_ch, ms_top_buff + (sample + s) * ch);
+                    }
+                }
+            }
+        }
+        else if(z_store.empty() ? no_less_than(z, z_buff[index]) : depth_code(z) >= load_depth_code(index)){
+            store_depth(index, z);
+            if(!depth_only){
+                store_color(index, color, color_ch);
+            }
+        }
+    }
+
+    /*
+    steps one pixel along the major axis and stamps `thickness` around each step
+    the segment is clipped once to the columns of the viewport and to image rows [y_min, y_max) inside the buffers,
+    stamps fully inside skip the per-pixel bounds checks
+    the line is stepped in rows of the whole image, so the bands of `paint_bands()` plot the pixels a whole frame would
+    */
+    void draw_line(const Eigen::Vector3f& a, const Eigen::Vector3f& b, const float* color, const int color_ch, const int thickness, const int y_min, const int y_max){
+        const int band_y = this->band_y;
         int dim = 0;
         if(std::abs(a[1] - b[1]) > std::abs(a[0] - b[0])){
             dim = 1;
@@ -372,181 +1108,858 @@ public:
             return;
         }
         i /= std::sqrt(x2y2);
-        for(;leftp[dim] < rightp[dim] + 0.5;leftp += i){
-            std::vector<Eigen::Vector3f> positions;
-            positions.push_back(leftp);
-            if(thickness > 1){
-                positions.push_back(Eigen::Vector3f(leftp[0] + 1, leftp[1], leftp[2]));
-                positions.push_back(Eigen::Vector3f(leftp[0], leftp[1] + 1, leftp[2]));
-                positions.push_back(Eigen::Vector3f(leftp[0] + 1, leftp[1] + 1, leftp[2]));
-            }
-            if(thickness > 2){
-                positions.push_back(Eigen::Vector3f(leftp[0] - 1, leftp[1], leftp[2]));
-                positions.push_back(Eigen::Vector3f(leftp[0] - 1, leftp[1] + 1, leftp[2]));
-                positions.push_back(Eigen::Vector3f(leftp[0], leftp[1] - 1, leftp[2]));
-                positions.push_back(Eigen::Vector3f(leftp[0] + 1, leftp[1] - 1, leftp[2]));
-                positions.push_back(Eigen::Vector3f(leftp[0] + 2, leftp[1], leftp[2]));
-                positions.push_back(Eigen::Vector3f(leftp[0] + 2, leftp[1] + 1, leftp[2]));
-                positions.push_back(Eigen::Vector3f(leftp[0], leftp[1] + 2, leftp[2]));
-                positions.push_back(Eigen::Vector3f(leftp[0] + 1, leftp[1] + 2, leftp[2]));
-            }
-            for(Eigen::Vector3f& position : positions){
-                float* pixel_ptr = this->get_top_buff(position);
-                float* z_ptr = this->get_z_buff(position);
-                if(pixel_ptr && z_ptr){
-                    if(no_less_than(leftp[2], *z_ptr)){
-                        *z_ptr = leftp[2];
-                        color_assign(color, pixel_ptr);
-                    }
+
+        const std::vector<Eigen::Vector2i>& stamp = line_stamp(thickness);
+        int sx0 = 0, sx1 = 0, sy0 = 0, sy1 = 0;
+        for(const Eigen::Vector2i& offset : stamp){
+            sx0 = offset[0] < sx0 ? offset[0] : sx0;
+            sx1 = offset[0] > sx1 ? offset[0] : sx1;
+            sy0 = offset[1] < sy0 ? offset[1] : sy0;
+            sy1 = offset[1] > sy1 ? offset[1] : sy1;
+        }
+
+        // steps k whose stamp can touch [0, w) x [y_min, y_max), with one pixel of slack for truncation
+        float k_min = 0;
+        float k_max = (rightp[dim] + 0.5f - leftp[dim]) / i[dim] + 1;
+        const float lo[2] = { (float)(-sx1 - 2), (float)(y_min - sy1 - 2) };
+        const float hi[2] = { (float)(this->w - sx0 + 1), (float)(y_max - sy0 + 1) };
+        for(int axis = 0;axis < 2;axis++){
+            if(i[axis] == 0){
+                if(leftp[axis] < lo[axis] || leftp[axis] > hi[axis]){
+                    return;
+                }
+                continue;
+            }
+            float k_lo = (lo[axis] - leftp[axis]) / i[axis];
+            float k_hi = (hi[axis] - leftp[axis]) / i[axis];
+            if(k_lo > k_hi){
+                std::swap(k_lo, k_hi);
+            }
+            maximize(k_min, k_lo);
+            minimize(k_max, k_hi);
+        }
+        if(k_min > k_max){
+            return;
+        }
+        const int k_begin = k_min > 0 ? (int)std::floor(k_min) : 0;
+        const int k_end = (int)std::ceil(k_max) + 1;
+
+        // positions are leftp + k * i rather than accumulated, so a clipped start lands on the same pixels
+        for(int k = k_begin;k < k_end;k++){
+            const Eigen::Vector3f p = leftp + i * (float)k;
+            if(!(p[dim] < rightp[dim] + 0.5)){
+                break;
+            }
+            const float z = p[2];
+            const int bx = (int)p[0];
+            const int by = (int)p[1];
+            if(!layout_tile && p[0] >= 0 && p[1] >= 0 && bx + sx0 >= 0 && bx + sx1 < this->w && by + sy0 >= y_min && by + sy1 < y_max){
+                const int base = pixel_index(bx, by - band_y); // row-major without layout_tile, so it also indexes cost_buff
+                for(const Eigen::Vector2i& offset : stamp){
+                    const int index = base + offset[0] + offset[1] * this->w;
+                    plot_line_pixel(index, index, z, color, color_ch);
                 }
+                continue;
+            }
+            for(const Eigen::Vector2i& offset : stamp){
+                int x = (int)(p[0] + offset[0]);
+                int y = (int)(p[1] + offset[1]);
+                if(x < 0 || x >= this->w || y < y_min || y >= y_max){
+                    continue;
+                }
+                plot_line_pixel(pixel_index(x, y - band_y), x + (y - band_y) * this->w, z, color, color_ch);
             }
         }
     }
-    inline void paint_line_simple(const Obj::Edge* edge, const Raster::Color& color, const int thickness = 2){
-        paint_line_simple(edge->start->projected_position, edge->end->projected_position, color, thickness);
+
+    void paint_line_simple(const Eigen::Vector3f& a, const Eigen::Vector3f& b, const Raster::Color& color, const int thickness){
+        this->stats.lines_drawn++;
+        float color_f[4];
+        color_assign(color, color_f);
+        draw_line(a, b, color_f, (int)color.image_color, thickness, this->band_y, this->band_y + this->h);
+    }
+    inline void paint_line_simple(const Raster::ProjectedMesh& mesh, const Obj::Edge* edge, const Raster::Color& color, const int thickness = 2){
+        paint_line_simple(mesh.position(edge->start), mesh.position(edge->end), color, thickness);
+    }
+
+    /*
+    draws a batch of lines in list order
+    rows are cut into bands, each line is binned to the bands it can touch
+    and bands are drawn concurrently, so the result equals drawing the lines one by one
+    */
+    void paint_lines(const std::vector<Raster::FeatureLine>& lines, const Raster::Color& color){
+        float color_f[4];
+        color_assign(color, color_f);
+        const int color_ch = (int)color.image_color;
+        this->stats.lines_drawn += lines.size();
+        const int band = 64;
+        const int bands = (this->h + band - 1) / band;
+        std::vector<std::vector<int>> bins(bands);
+        for(int l = 0;l < (int)lines.size();l++){
+            const Eigen::Vector3f& a = *lines[l].start;
+            const Eigen::Vector3f& b = *lines[l].end;
+            int reach = lines[l].thickness / 2 + 3;
+            float y_lo = min(a[1], b[1]) - reach - this->band_y;
+            float y_hi = max(a[1], b[1]) + reach - this->band_y;
+            if(!(y_hi >= 0 && y_lo < this->h)){ // also drops NaN
+                continue;
+            }
+            int b_lo = y_lo < 0 ? 0 : (int)y_lo / band;
+            int b_hi = y_hi >= this->h ? bands - 1 : (int)y_hi / band;
+            for(int k = b_lo;k <= b_hi;k++){
+                bins[k].push_back(l);
+            }
+        }
+        parallel_for(0, bands, [&](int b_begin, int b_end){
+            for(int k = b_begin;k < b_end;k++){
+                int y_min = k * band;
+                int y_max = y_min + band < this->h ? y_min + band : this->h;
+                for(int l : bins[k]){
+                    draw_line(*lines[l].start, *lines[l].end, color_f, color_ch, lines[l].thickness, y_min + this->band_y, y_max + this->band_y);
+                }
+            }
+        });
     }
-    void paint_frame_simple(std::vector<Obj::ObjSet*>& obj_set, Raster::Color color, bool verbose){
+
+    void paint_frame_simple(std::vector<Obj::ObjSet*>& source_set, Raster::Color color, bool verbose){
+        this->stats.reset();
+        auto t0 = std::chrono::steady_clock::now();
         this->init_buffs();
-        int i = 0;
+        std::vector<Obj::ObjSet*> drawn;
+        const std::vector<Obj::ObjSet*>& obj_set = select_lods(source_set, drawn);
         project_vertices(obj_set, verbose);
+        this->stats.project_ms += elapsed_ms(t0);
 
-        for(Obj::ObjSet* obj : obj_set){
-            i = 0;
-            for(Obj::Edge* edge : obj->edges){
-                paint_line_simple(edge, color);
-                if(verbose){
-                    i++;
-                    if(i % 100 == 0 || i == obj->edges.size()){
-                        print_progress(i, obj->edges.size(), "Paint edge");
-                    }
-                }
+        std::vector<Raster::FeatureLine> lines;
+        for(int o = 0;o < (int)obj_set.size();o++){
+            const Raster::ProjectedMesh& mesh = this->projected[o];
+            for(const Obj::Edge* edge : obj_set[o]->geometry().boundary_edges){
+                lines.push_back({ &mesh.position(edge->start), &mesh.position(edge->end), 2 });
             }
-            if(verbose){
-                std::cout << std::endl;
+            for(const Obj::Edge* edge : obj_set[o]->geometry().interior_edges){
+                lines.push_back({ &mesh.position(edge->start), &mesh.position(edge->end), 2 });
             }
         }
+        paint_lines(lines, color);
+        if(verbose){
+            std::cout << "Paint edge: " << lines.size() << std::endl;
+        }
+        this->stats.lines_ms += elapsed_ms(t0);
+        this->resolve_msaa();
+        this->linearize_buffs(false);
+        this->stats.resolve_ms += elapsed_ms(t0);
         if(verbose){
             std::cout << "End paint_frame_simple()" << std::endl;
         }
     }
 
-    
-    void paint(Raster::Shader& shader,
-        const std::vector<Obj::ObjSet*>& obj_set,
+    /*
+    multisampled coverage and depth for one pixel, the shader runs once
+    against a scratch depth and its color is copied to every sample that passed
+    `y` is an image row like the projected corners, see `set_band()`
+    */
+    inline bool shade_msaa_pixel(Raster::Shader& shader,
+        const Obj::ObjSet* obj,
+        const Obj::Triangle* triangle,
+        const Raster::ProjectedTriangle& projected,
+        const Raster::TriangleEdges& edges,
         const Raster::Color& fill_color,
-        const bool paint_back,
+        const int x,
+        const int y,
         const bool verbose){
 
-        this->init_buffs();
-        int i = 0;
-        project_vertices(obj_set, verbose);
-
-        for(Obj::ObjSet* obj : obj_set){
-            i = 0;
-            for(Obj::Triangle* triangle : obj->triangles){
-                triangle->calculate_normal();
-                if(verbose){
-                    i++;
-                    if(i % 100 == 0 || i == obj->triangles.size()){
-                        print_progress(i, obj->triangles.size(), "Triangle normal calculation");
-                    }
+        const Eigen::Vector2f* pattern = msaa_pattern();
+        const int index = pixel_index(x, y - this->band_y) * msaa;
+        const int ch = (int)bg_color.image_color;
+        unsigned int mask = 0;
+        float sample_z[8];
+        int first = -1;
+        this->stats.fragments_tested += msaa;
+        for(int s = 0;s < msaa;s++){
+            float sx = x + pattern[s][0];
+            float sy = y + pattern[s][1];
+            if(!edges.covers(sx, sy)){
+                continue;
+            }
+            if(first < 0){
+                first = s;
+            }
+            float z = projected.get_z(projected.get_barycentric_coordinate(sx, sy));
+            if(z > 0 || z < ms_z_buff[index + s]){
+                this->stats.depth_rejects++;
+                this->stats.early_rejects++;
+                continue;
+            }
+            mask |= 1u << s;
+            sample_z[s] = z;
+        }
+        if(!mask){
+            return false;
+        }
+        Eigen::Vector3f bc_coord;
+        if(edges.covers(x, y)){
+            bc_coord = projected.get_barycentric_coordinate(x, y);
+        }
+        else{ // pixel center is outside, shade at the first covered sample to avoid extrapolation
+            bc_coord = projected.get_barycentric_coordinate(x + pattern[first][0], y + pattern[first][1]);
+        }
+        float scratch_z = -MAX_F;
+        float scratch_color[4];
+        this->stats.fragments_shaded++;
+        if(!shader.shade(obj, triangle, projected, bc_coord, fill_color, &scratch_z, scratch_color, verbose)){
+            this->stats.depth_rejects++;
+            return false;
+        }
+        this->stats.fragments_written++;
+        for(int s = 0;s < msaa;s++){
+            if(mask & (1u << s)){
+                ms_z_buff[index + s] = sample_z[s];
+                if(!depth_only){
+                    std::copy(scratch_color, scratch_color + ch, ms_top_buff + (index + s) * ch);
                 }
             }
-            if(verbose){
-                std::cout << std::endl;
+        }
+        return true;
+    }
+
+    /*
+    level of detail of `obj` for this view, the coarsest of its `lods` whose error projects within `lod_pixel_error` pixels
+    pixels per world unit come from the projected extent of the mesh bounds,
+    full detail when the bounds reach behind the camera
+    */
+    Obj::ObjSet* select_lod(Obj::ObjSet* obj) const{
+        if(obj->lods.empty() || this->lod_pixel_error <= 0 || obj->geometry().clusters.empty()){
+            return obj;
+        }
+        const BVH::BBox bbox = obj->bounds();
+        const float world = (bbox.high_bound - bbox.low_bound).maxCoeff();
+        if(world <= 0){
+            return obj;
+        }
+        Eigen::Matrix3Xf corners(3, 8);
+        for(int c = 0;c < 8;c++){
+            corners.col(c) = bbox.corner(c);
+        }
+        Eigen::Vector3f projected_corners[8];
+        project_points(corners, projected_corners);
+        BVH::BBox screen;
+        for(const Eigen::Vector3f& corner : projected_corners){
+            if(!(corner[2] <= 0)){
+                return obj;
             }
+            screen.extend(corner);
         }
-        if(verbose){
-            std::cout << "Triangle normal calculated" << std::endl;
-        }
-        for(Obj::ObjSet* obj : obj_set){
-            i = 1;
-            for(Obj::Triangle* triangle : obj->triangles){
-                if(verbose){
-                    i++;
-                    if(i % 100 == 0 || i == obj->triangles.size()){
-                        print_progress(i, obj->triangles.size(), "Triangle rasterizing");
-                    }
+        const float pixels_per_unit = std::max(screen.high_bound[0] - screen.low_bound[0], screen.high_bound[1] - screen.low_bound[1]) / world;
+        for(int i = (int)obj->lods.size() - 1;i >= 0;i--){
+            if(obj->lod_errors[i] * pixels_per_unit <= this->lod_pixel_error){
+                return obj->lods[i];
+            }
+        }
+        return obj;
+    }
+    /*
+    `obj_set` with every mesh replaced by its select_lod(), `obj_set` itself when no mesh has levels
+    entries keep their index, so id_buff object ids stay the same
+    */
+    const std::vector<Obj::ObjSet*>& select_lods(const std::vector<Obj::ObjSet*>& obj_set, std::vector<Obj::ObjSet*>& drawn){
+        bool any = false;
+        for(const Obj::ObjSet* obj : obj_set){
+            any = any || !obj->lods.empty();
+        }
+        if(!any || this->lod_pixel_error <= 0){
+            return obj_set;
+        }
+        drawn.resize(obj_set.size());
+        for(int o = 0;o < (int)obj_set.size();o++){
+            drawn[o] = select_lod(obj_set[o]);
+            this->stats.triangles_lod_saved += obj_set[o]->geometry().triangles.size() - drawn[o]->geometry().triangles.size();
+        }
+        return drawn;
+    }
+
+    /*
+    depth of a box for front-to-back ordering, distance from the eye in perspective,
+    the nearest corner along the view direction in orthographic projection
+    */
+    inline float order_key(const BVH::BBox& bbox) const{
+        if(this->projection_type == Projection::ORTHO){
+            return bbox.min_along(this->lookat_g);
+        }
+        return bbox.distance2(this->position);
+    }
+    /*
+    indices of `obj_set` in paint order, nearest bounds first when `front_to_back`,
+    otherwise the given order
+    */
+    void paint_order(const std::vector<Obj::ObjSet*>& obj_set, std::vector<int>& obj_order) const{
+        obj_order.resize(obj_set.size());
+        std::vector<float> keys(obj_set.size(), MAX_F);
+        for(int o = 0;o < (int)obj_set.size();o++){
+            obj_order[o] = o;
+            if(this->front_to_back && !obj_set[o]->geometry().clusters.empty()){
+                keys[o] = order_key(obj_set[o]->bounds());
+            }
+        }
+        if(this->front_to_back){
+            std::stable_sort(obj_order.begin(), obj_order.end(), [&keys](int a, int b){
+                return keys[a] < keys[b];
+            });
+        }
+    }
+    /*
+    triangle indices of `obj` by walking its cluster tree nearest child first,
+    triangles inside a cluster keep their file order
+    false when the tree does not match the mesh
+    */
+    bool paint_order(const Obj::ObjSet* obj, std::vector<int>& triangle_order) const{
+        const BVH::Tree& clusters = obj->geometry().clusters;
+        if(clusters.order.size() != obj->geometry().triangles.size()){
+            return false;
+        }
+        triangle_order.clear();
+        clusters.traverse_ordered([this, obj](const BVH::BBox& bbox){
+            return order_key(obj->to_world(bbox));
+        }, [&](int first, int count){
+            triangle_order.insert(triangle_order.end(), clusters.order.begin() + first, clusters.order.begin() + first + count);
+        });
+        return true;
+    }
+
+    static inline bool is_triangle_visible(const Raster::ProjectedTriangle& triangle, const bool paint_back){
+        if(!paint_back && triangle.normal.z() < 0){
+            return false;
+        }
+        return !(triangle.A[2] > 0 && triangle.B[2] > 0 && triangle.C[2] > 0);
+    }
+    /*
+    per-frame outline pass, needs `project_vertices()` of this frame
+    every undirected edge is classified once: boundary and silhouette edges get `thickness`,
+    the remaining creases (precomputed at load) get `crease_thickness`
+    */
+    void extract_feature_lines(const Raster::Shader& shader,
+        const std::vector<Obj::ObjSet*>& obj_set,
+        const bool paint_back,
+        std::vector<Raster::FeatureLine>& lines) const{
+
+        int thickness, crease_thickness;
+        float crease_angle;
+        try{
+            thickness = shader.thickness.value();
+            crease_thickness = shader.crease_thickness.value();
+            crease_angle = shader.crease_angle.value();
+        }
+        catch(const std::bad_optional_access& e){
+            throw Manga3DException("Raster::Camera::extract_feature_lines(): shader thickness, crease_thickness or crease_angle empty", e);
+        }
+        for(int o = 0;o < (int)obj_set.size();o++){
+            const Obj::ObjSet* obj = &obj_set[o]->geometry();
+            const Raster::ProjectedMesh& mesh = this->projected[o];
+            for(const Obj::Edge* edge : obj->boundary_edges){
+                if(is_triangle_visible(mesh.triangle(edge->triangle), paint_back)){
+                    lines.push_back({ &mesh.position(edge->start), &mesh.position(edge->end), thickness });
                 }
-                if(!paint_back && triangle->normal.value().z() < 0){
-                    continue;
+            }
+            const int n = obj->interior_edges.size();
+            const int creases = obj->crease_count(crease_angle);
+            const int chunk = 4096;
+            std::vector<std::vector<Raster::FeatureLine>> found((n + chunk - 1) / chunk);
+            parallel_for(0, found.size(), [&](int c_begin, int c_end){
+                for(int c = c_begin;c < c_end;c++){
+                    int e_end = (c + 1) * chunk < n ? (c + 1) * chunk : n;
+                    for(int e = c * chunk;e < e_end;e++){
+                        const Obj::Edge* edge = obj->interior_edges[e];
+                        const Raster::ProjectedTriangle a = mesh.triangle(edge->triangle);
+                        const Raster::ProjectedTriangle b = mesh.triangle(edge->reverse->triangle);
+                        float a_z = a.normal[2];
+                        float b_z = b.normal[2];
+                        if((a_z > 0 && b_z < 0) || (a_z < 0 && b_z > 0)){
+                            if(is_triangle_visible(a_z > 0 ? a : b, true)){
+                                found[c].push_back({ &mesh.position(edge->start), &mesh.position(edge->end), thickness });
+                            }
+                        }
+                        else if(e < creases && (is_triangle_visible(a, paint_back) || is_triangle_visible(b, paint_back))){
+                            found[c].push_back({ &mesh.position(edge->start), &mesh.position(edge->end), crease_thickness });
+                        }
+                    }
                 }
-                if(triangle->A->projected_position[2] > 0 && triangle->B->projected_position[2] > 0 && triangle->C->projected_position[2] > 0){
+            });
+            for(std::vector<Raster::FeatureLine>& part : found){
+                lines.insert(lines.end(), part.begin(), part.end());
+            }
+        }
+    }
+
+    /*
+    bins the shader's light_spheres() into `light_tiles` for light_reach()
+    a tile keeps the lights whose sphere overlaps it on screen and within the depth range
+    of the triangles that can cover it, spheres are bounded on screen by their box corners
+    tiles cover the rows of the whole image, so the bands of `paint_bands()` share one build
+    false, leaving every light to every pixel, when tiling is off, the projection is FISHEYE
+    or no light has a finite radius
+    */
+    bool build_light_tiles(const Raster::Shader& shader, const std::vector<Obj::ObjSet*>& obj_set, const bool paint_back){
+        if(this->light_tile <= 0 || this->projection_type == Projection::FISHEYE){
+            return false;
+        }
+        std::vector<Raster::LightSphere> spheres;
+        shader.light_spheres(spheres);
+        bool finite = false;
+        for(const Raster::LightSphere& sphere : spheres){
+            finite = finite || sphere.radius != MAX_F;
+        }
+        if(!finite){
+            return false;
+        }
+        const int t = this->light_tile;
+        const int rows = this->frame_h ? this->frame_h : this->h;
+        this->light_tiles_x = (this->w + t - 1) / t;
+        const int tiles_y = (rows + t - 1) / t;
+        const int tiles = this->light_tiles_x * tiles_y;
+
+        // projected depth range per tile, larger is closer, empty tiles keep low > high
+        std::vector<float> z_low(tiles, MAX_F);
+        std::vector<float> z_high(tiles, -MAX_F);
+        for(int o = 0;o < (int)obj_set.size();o++){
+            const Raster::ProjectedMesh& mesh = this->projected[o];
+            for(const Obj::Triangle* triangle : obj_set[o]->geometry().triangles){
+                const Raster::ProjectedTriangle projected = mesh.triangle(triangle);
+                if(!is_triangle_visible(projected, paint_back)){
                     continue;
                 }
                 float l, r, u, d;
-                l = min(triangle->A->projected_position[0], triangle->B->projected_position[0], triangle->C->projected_position[0]) - 1;
-                r = max(triangle->A->projected_position[0], triangle->B->projected_position[0], triangle->C->projected_position[0]) + 1;
-                u = min(triangle->A->projected_position[1], triangle->B->projected_position[1], triangle->C->projected_position[1]) - 1;
-                d = max(triangle->A->projected_position[1], triangle->B->projected_position[1], triangle->C->projected_position[1]) + 1;
+                l = min(projected.A[0], projected.B[0], projected.C[0]) - 1;
+                r = max(projected.A[0], projected.B[0], projected.C[0]) + 1;
+                u = min(projected.A[1], projected.B[1], projected.C[1]) - 1;
+                d = max(projected.A[1], projected.B[1], projected.C[1]) + 1;
                 maximize(l, 0);
                 minimize(r, this->w - 0.9);
                 maximize(u, 0);
-                minimize(d, this->h - 0.9);
+                minimize(d, rows - 0.9);
                 if(l > r || u > d){
                     continue;
                 }
-                for(int y = u;y < d;y++){
-                    for(int x = l;x < r;x++){
-                        if(!triangle->is_inside_triangle(x, y)){
-                            continue;
-                        }
-                        Eigen::Vector3f bc_coord = triangle->get_barycentric_coordinate(x, y);
-                        float* z_p = this->get_z_buff_trust(x, y);
-                        float* top_p = this->get_top_buff_trust(x, y);
-                        shader.shade(obj, triangle, bc_coord, fill_color, z_p, top_p, verbose);
+                const float low = min(projected.A[2], projected.B[2], projected.C[2]);
+                const float high = min(max(projected.A[2], projected.B[2], projected.C[2]), 0);
+                for(int ty = (int)u / t;ty <= (int)d / t;ty++){
+                    for(int tx = (int)l / t;tx <= (int)r / t;tx++){
+                        const int tile = tx + ty * this->light_tiles_x;
+                        minimize(z_low[tile], low);
+                        maximize(z_high[tile], high);
                     }
                 }
+            }
+        }
 
-                if(shader.do_outline){
-                    bool outline_AB = false;
-                    bool outline_BC = false;
-                    bool outline_CA = false;
-                    outline_AB |= (triangle->AB->is_boundary() || triangle->AB->is_silhouette());
-                    outline_BC |= (triangle->BC->is_boundary() || triangle->BC->is_silhouette());
-                    outline_CA |= (triangle->CA->is_boundary() || triangle->CA->is_silhouette());
-
-                    bool crease_AB = false;
-                    bool crease_BC = false;
-                    bool crease_CA = false;
-                    try{
-                        crease_AB |= triangle->AB->is_crease(shader.crease_angle.value());
-                        crease_BC |= triangle->BC->is_crease(shader.crease_angle.value());
-                        crease_CA |= triangle->CA->is_crease(shader.crease_angle.value());
+        this->light_tiles.resize(tiles);
+        for(std::vector<int>& tile : this->light_tiles){
+            tile.clear();
+        }
+        const float n = this->near;
+        const float f = this->far;
+        for(const Raster::LightSphere& sphere : spheres){
+            int x0 = 0, x1 = this->light_tiles_x - 1;
+            int y0 = 0, y1 = tiles_y - 1;
+            float sphere_low = -MAX_F;
+            float sphere_high = MAX_F;
+            if(sphere.radius != MAX_F){
+                const float depth = (sphere.center - this->position).dot(this->lookat_g);
+                const float depth_near = depth - sphere.radius;
+                const float depth_far = depth + sphere.radius;
+                bool whole_screen = false;
+                if(this->projection_type == Projection::PERSP){
+                    if(depth_far <= n){
+                        continue;
                     }
-                    catch(const std::bad_optional_access& e){
-                        throw Manga3DException("Raster::Camera::paint(): shader crease_angle empty", e);
+                    sphere_low = n * f / depth_far - (n + f);
+                    sphere_high = depth_near <= n ? MAX_F : n * f / depth_near - (n + f);
+                }
+                else{
+                    sphere_low = -depth_far;
+                    sphere_high = -depth_near;
+                }
+                BVH::BBox screen;
+                for(int c = 0;c < 8 && !whole_screen;c++){
+                    Eigen::Vector3f corner = sphere.center + Eigen::Vector3f(c & 1 ? 1 : -1, c & 2 ? 1 : -1, c & 4 ? 1 : -1) * sphere.radius;
+                    if(this->projection_type == Projection::PERSP && (corner - this->position).dot(this->lookat_g) <= n){
+                        whole_screen = true;
+                    }
+                    projection(corner);
+                    screen.extend(corner);
+                }
+                if(!whole_screen){
+                    if(screen.high_bound[0] < 0 || screen.high_bound[1] < 0 || screen.low_bound[0] >= this->w || screen.low_bound[1] >= rows){
+                        continue;
+                    }
+                    x0 = (int)std::max(screen.low_bound[0], 0.0f) / t;
+                    x1 = (int)std::min(screen.high_bound[0], this->w - 1.0f) / t;
+                    y0 = (int)std::max(screen.low_bound[1], 0.0f) / t;
+                    y1 = (int)std::min(screen.high_bound[1], rows - 1.0f) / t;
+                }
+            }
+            for(int ty = y0;ty <= y1;ty++){
+                for(int tx = x0;tx <= x1;tx++){
+                    const int tile = tx + ty * this->light_tiles_x;
+                    if(z_low[tile] <= z_high[tile] && sphere_high >= z_low[tile] && sphere_low <= z_high[tile]){
+                        this->light_tiles[tile].push_back(sphere.index);
                     }
-                    try{
-                        if(outline_AB){
-                            paint_line_simple(triangle->AB, shader.line_color.value(), shader.thickness.value());
+                }
+            }
+        }
+        return true;
+    }
+
+    void paint(Raster::Shader& shader,
+        const std::vector<Obj::ObjSet*>& source_set,
+        const Raster::Color& fill_color,
+        const bool paint_back,
+        const bool verbose){
+
+        const bool screen_outline = shader.do_outline && shader.outline_mode == Raster::Shader::OutlineMode::SCREEN;
+        this->stats.reset();
+        Raster::StatsScope stats_scope(this->stats);
+        auto t0 = std::chrono::steady_clock::now();
+        this->init_buffs();
+        if(screen_outline){
+            this->init_gbuffs();
+        }
+        std::vector<Obj::ObjSet*> drawn;
+        const std::vector<Obj::ObjSet*>& obj_set = select_lods(source_set, drawn);
+        project_vertices(obj_set, verbose);
+        const bool tiled = light_tiles_for(shader, obj_set, paint_back);
+        const bool compact = this->compact();
+        if(!z_store.empty()){
+            fit_depth_codes();
+        }
+        Raster::tile_lights() = nullptr;
+        this->stats.project_ms += elapsed_ms(t0);
+
+        const bool console_progress = verbose && !this->progress;
+        if(console_progress){
+            this->progress.callback = Raster::Progress::console;
+        }
+        std::vector<int> obj_order;
+        std::vector<int> triangle_order;
+        paint_order(obj_set, obj_order);
+        for(int o : obj_order){
+            Obj::ObjSet* obj = obj_set[o];
+            const Raster::ProjectedMesh& mesh = this->projected[o];
+            const int obj_id = o + 1;
+            const std::vector<Obj::Triangle*>& triangles = obj->geometry().triangles;
+            const std::vector<const Obj::Triangle*>* bin = band_bin(obj);
+            const bool reorder = !bin && this->front_to_back && paint_order(obj, triangle_order);
+            const int count = bin ? bin->size() : triangles.size();
+            shader.begin_object(obj);
+            this->stats.triangles_in += count;
+            this->progress.begin("Triangle rasterizing", count);
+            for(int k = 0;k < count;k++){
+                this->progress.tick(k);
+                const Obj::Triangle* triangle = bin ? (*bin)[k] : triangles[reorder ? triangle_order[k] : k];
+                const Raster::ProjectedTriangle projected = mesh.triangle(triangle);
+                if(!paint_back && projected.normal.z() < 0){
+                    this->stats.triangles_backface++;
+                    continue;
+                }
+                if(!is_triangle_visible(projected, true)){
+                    this->stats.triangles_culled++;
+                    continue;
+                }
+                float l, r, u, d;
+                l = min(projected.A[0], projected.B[0], projected.C[0]) - 1;
+                r = max(projected.A[0], projected.B[0], projected.C[0]) + 1;
+                u = min(projected.A[1], projected.B[1], projected.C[1]) - 1;
+                d = max(projected.A[1], projected.B[1], projected.C[1]) + 1;
+                maximize(l, 0);
+                minimize(r, this->w - 0.9);
+                maximize(u, this->band_y);
+                minimize(d, this->band_y + this->h - 0.9);
+                if(l > r || u > d){
+                    this->stats.triangles_culled++;
+                    continue;
+                }
+                const Eigen::Vector3f face_normal = screen_outline ? obj->normal_to_world(triangle->face_normal) : triangle->face_normal;
+                const Raster::TriangleEdges edges(projected);
+                for(int y = u;y < d;y++){
+                    Raster::TriangleEdges::Row row = edges.begin(l, y);
+                    for(int x = l;x < r;x++, row.next()){
+                        bool written;
+                        Raster::PixelCost* cost = cost_buff.empty() ? nullptr : &cost_buff[x + (y - this->band_y) * this->w];
+                        uint8_t* shade = shade_buff.empty() ? nullptr : &shade_buff[x + (y - this->band_y) * this->w];
+                        if(shade){
+                            Raster::fragment_light() = 1;
                         }
-                        else if(crease_AB){
-                            paint_line_simple(triangle->AB, shader.line_color.value(), shader.crease_thickness.value());
+                        if(tiled){
+                            Raster::tile_lights() = &light_tiles[x / light_tile + y / light_tile * light_tiles_x];
                         }
-                        if(outline_BC){
-                            paint_line_simple(triangle->BC, shader.line_color.value(), shader.thickness.value());
+                        if(msaa > 1){
+                            if(cost){
+                                const Raster::RenderStats before = this->stats;
+                                written = shade_msaa_pixel(shader, obj, triangle, projected, edges, fill_color, x, y, verbose);
+                                cost->tested += this->stats.fragments_tested - before.fragments_tested;
+                                cost->shaded += this->stats.fragments_shaded - before.fragments_shaded;
+                                cost->shadow_lookups += this->stats.shadow_lookups - before.shadow_lookups;
+                            }
+                            else{
+                                written = shade_msaa_pixel(shader, obj, triangle, projected, edges, fill_color, x, y, verbose);
+                            }
                         }
-                        else if(crease_BC){
-                            paint_line_simple(triangle->BC, shader.line_color.value(), shader.crease_thickness.value());
+                        else{
+                            this->stats.fragments_tested++;
+                            if(cost){
+                                cost->tested++;
+                            }
+                            if(!(edges.fixed ? row.inside() : projected.is_inside_triangle(x, y))){
+                                continue;
+                            }
+                            Eigen::Vector3f bc_coord = projected.get_barycentric_coordinate(x, y);
+                            const int index = pixel_index(x, y - this->band_y);
+                            // compact buffers are tested and written around the shader, which shades into floats
+                            float scratch_z = -MAX_F;
+                            float scratch_color[4];
+                            float* z_p = compact ? &scratch_z : this->z_buff + index;
+                            float* top_p = compact || depth_only ? scratch_color : this->top_buff + index * (int)bg_color.image_color;
+                            if(shader.early_z){
+                                float z = projected.get_z(bc_coord);
+                                if(z > 0 || (compact ? !depth_test(index, z) : z < *z_p)){
+                                    this->stats.depth_rejects++;
+                                    this->stats.early_rejects++;
+                                    continue;
+                                }
+                            }
+                            const uint64_t shadow_before = this->stats.shadow_lookups;
+                            this->stats.fragments_shaded++;
+                            written = shader.shade(obj, triangle, projected, bc_coord, fill_color, z_p, top_p, verbose);
+                            if(written && compact){
+                                written = shader.early_z || depth_test(index, scratch_z);
+                                if(written){
+                                    store_depth(index, scratch_z);
+                                    if(!depth_only){
+                                        store_color(index, scratch_color, (int)bg_color.image_color);
+                                    }
+                                }
+                            }
+                            if(cost){
+                                cost->shaded++;
+                                cost->shadow_lookups += this->stats.shadow_lookups - shadow_before;
+                            }
+                            if(written){
+                                this->stats.fragments_written++;
+                            }
+                            else{
+                                this->stats.depth_rejects++;
+                            }
                         }
-                        if(outline_CA){
-                            paint_line_simple(triangle->CA, shader.line_color.value(), shader.thickness.value());
+                        if(written && shade){
+                            *shade = (uint8_t)std::lround(Raster::fragment_light() * 255);
                         }
-                        else if(crease_CA){
-                            paint_line_simple(triangle->CA, shader.line_color.value(), shader.crease_thickness.value());
+                        if(written && screen_outline){
+                            int index = pixel_index(x, y - this->band_y);
+                            id_buff[index] = obj_id;
+                            normal_buff[index * 3] = face_normal[0];
+                            normal_buff[index * 3 + 1] = face_normal[1];
+                            normal_buff[index * 3 + 2] = face_normal[2];
                         }
                     }
-                    catch(const std::bad_optional_access& e){
-                        throw Manga3DException("Raster::Camera::paint(): shader thickness or line_color empty", e);
-                    }
                 }
             }
+            this->progress.end();
+        }
+        if(console_progress){
+            this->progress.callback = nullptr;
+        }
+        Raster::tile_lights() = nullptr;
+        this->stats.raster_ms += elapsed_ms(t0);
+
+        if(shader.do_outline && !screen_outline){
+            std::vector<Raster::FeatureLine> extracted;
+            const std::vector<Raster::FeatureLine>& lines = feature_lines(shader, obj_set, paint_back, extracted);
+            try{
+                paint_lines(lines, shader.line_color.value());
+            }
+            catch(const std::bad_optional_access& e){
+                throw Manga3DException("Raster::Camera::paint(): shader line_color empty", e);
+            }
             if(verbose){
-                std::cout << std::endl;
+                std::cout << "Feature lines: " << lines.size() << std::endl;
             }
+            this->stats.lines_ms += elapsed_ms(t0);
         }
+        this->resolve_msaa();
+        this->linearize_buffs(screen_outline);
         shader.post_shade(this->top_buff);
+        this->stats.resolve_ms += elapsed_ms(t0);
+    }
+
+    /*
+    renders an image of `frame_h` rows `band_rows` at a time, for images whose buffers would not fit in memory,
+    the buffers only ever hold one band, so peak memory follows `band_rows` rather than the image
+    vertices are projected once in rows of the whole image, which every band keeps, see `set_band()`,
+    triangles are binned to bands from that projection and a band only rasterizes its own, already in front_to_back order when set,
+    feature lines and light tiles are likewise built once by the first band's paint and shared, see `feature_lines()`
+    bands are painted `apron` rows taller where the image continues, so post stages reading neighbours stay seamless
+    `band(top, y, rows)` paints and post-processes the band, rows [top, top + rows) of the buffers are then image rows [y, y + rows)
+    the buffers are left holding the last band, config() the camera again before painting whole frames
+    */
+    void paint_bands(const std::vector<Obj::ObjSet*>& source_set, const int frame_h, const int band_rows, const int apron, const std::function<void(int top, int y, int rows)>& band){
+        if(frame_h <= 0 || band_rows <= 0 || apron < 0){
+            throw Manga3DException("Raster::Camera::paint_bands(): frame_h and band_rows must be positive, apron not negative");
+        }
+        Raster::Color bg_color = this->bg_color;
+        Eigen::Vector3f position = this->position;
+        Eigen::Vector3f lookat_g = this->lookat_g;
+        const float up_t = this->up_t.value_or(0);
+        const int bands = (frame_h + band_rows - 1) / band_rows;
+        auto config_band = [&](int b, int& top, int& y, int& rows){
+            y = b * band_rows;
+            rows = std::min(band_rows, frame_h - y);
+            top = std::min(apron, y);
+            const int bottom = std::min(apron, frame_h - y - rows);
+            set_band(frame_h, y - top);
+            config(this->projection_type, bg_color, this->w, top + rows + bottom, this->fovY, position, lookat_g, up_t, this->near, this->far);
+        };
+
+        int top, y, rows;
+        config_band(0, top, y, rows);
+        std::vector<Obj::ObjSet*> drawn;
+        const std::vector<Obj::ObjSet*>& obj_set = select_lods(source_set, drawn);
+        project_vertices(obj_set, false);
+        bin_bands(obj_set, frame_h, band_rows, apron);
+        try{
+            for(int b = 0;b < bands;b++){
+                if(b > 0){
+                    config_band(b, top, y, rows);
+                }
+                this->active_band = b;
+                band(top, y, rows);
+            }
+        }
+        catch(...){
+            end_bands();
+            throw;
+        }
+        end_bands();
+    }
+
+private:
+    /*
+    fills band_bins and band_spans from `projected`, whose rows are image rows
+    a triangle goes to every band its bounding box, grown by the pixel paint() adds, overlaps with the apron,
+    one reaching behind the camera goes to every band
+    */
+    void bin_bands(const std::vector<Obj::ObjSet*>& obj_set, const int frame_h, const int band_rows, const int apron){
+        const int bands = (frame_h + band_rows - 1) / band_rows;
+        this->band_bins.assign(bands, {});
+        this->band_spans.resize(bands);
+        for(int b = 0;b < bands;b++){
+            this->band_spans[b] = std::make_pair(std::max(b * band_rows - apron, 0), std::min((b + 1) * band_rows + apron, frame_h));
+        }
+        std::vector<int> triangle_order;
+        for(int o = 0;o < (int)obj_set.size();o++){
+            const Obj::ObjSet* obj = obj_set[o];
+            const Raster::ProjectedMesh& mesh = this->projected[o];
+            const std::vector<Obj::Triangle*>& triangles = obj->geometry().triangles;
+            const bool reorder = this->front_to_back && paint_order(obj, triangle_order);
+            for(int b = 0;b < bands;b++){
+                this->band_bins[b][obj];
+            }
+            for(int k = 0;k < (int)triangles.size();k++){
+                const Obj::Triangle* triangle = triangles[reorder ? triangle_order[k] : k];
+                const Raster::ProjectedTriangle projected = mesh.triangle(triangle);
+                if(!is_triangle_visible(projected, true)){
+                    continue;
+                }
+                float u = min(projected.A[1], projected.B[1], projected.C[1]) - 1 - apron;
+                float d = max(projected.A[1], projected.B[1], projected.C[1]) + 1 + apron;
+                int b_lo = 0;
+                int b_hi = bands - 1;
+                if(!(projected.A[2] > 0 || projected.B[2] > 0 || projected.C[2] > 0)){
+                    if(!(d >= 0 && u < frame_h)){ // also drops NaN
+                        continue;
+                    }
+                    b_lo = u < 0 ? 0 : (int)u / band_rows;
+                    b_hi = d >= frame_h ? bands - 1 : (int)d / band_rows;
+                }
+                for(int b = b_lo;b <= b_hi;b++){
+                    this->band_bins[b][obj].push_back(triangle);
+                }
+            }
+        }
+    }
+    inline void end_bands(){
+        this->active_band = -1;
+        this->band_bins.clear();
+        this->band_spans.clear();
+        this->band_lines.clear();
+        this->band_lines_key.reset();
+        this->band_tiles_key.reset();
+        set_band(0, 0);
+    }
+    /*triangles of `obj` the current band rasterizes, nullptr outside paint_bands() or for objects it did not bin*/
+    inline const std::vector<const Obj::Triangle*>* band_bin(const Obj::ObjSet* obj) const{
+        if(this->active_band < 0){
+            return nullptr;
+        }
+        const auto& bin = this->band_bins[this->active_band];
+        auto it = bin.find(obj);
+        return it == bin.end() ? nullptr : &it->second;
+    }
+    /*
+    `build_light_tiles()`, once per paint_bands() while the shader's light spheres and paint_back stay the same,
+    as the tiles cover the whole image
+    */
+    bool light_tiles_for(const Raster::Shader& shader, const std::vector<Obj::ObjSet*>& obj_set, const bool paint_back){
+        if(this->active_band < 0){
+            return build_light_tiles(shader, obj_set, paint_back);
+        }
+        std::vector<Raster::LightSphere> spheres;
+        shader.light_spheres(spheres);
+        auto same = [&](const std::vector<Raster::LightSphere>& built){
+            if(built.size() != spheres.size()){
+                return false;
+            }
+            for(int i = 0;i < (int)spheres.size();i++){
+                if(built[i].index != spheres[i].index || built[i].center != spheres[i].center || built[i].radius != spheres[i].radius){
+                    return false;
+                }
+            }
+            return true;
+        };
+        if(!this->band_tiles_key || this->band_tiles_key->second != paint_back || !same(this->band_tiles_key->first)){
+            this->band_tiled = build_light_tiles(shader, obj_set, paint_back);
+            this->band_tiles_key = std::make_pair(std::move(spheres), paint_back);
+        }
+        return this->band_tiled;
+    }
+    /*
+    the feature lines paint() strokes, extracted into `lines` outside paint_bands(),
+    during paint_bands() extracted once for the whole image and binned to the bands their stamps reach,
+    again only when the shader's line settings or paint_back change
+    */
+    const std::vector<Raster::FeatureLine>& feature_lines(const Raster::Shader& shader,
+        const std::vector<Obj::ObjSet*>& obj_set,
+        const bool paint_back,
+        std::vector<Raster::FeatureLine>& lines){
+
+        if(this->active_band < 0){
+            extract_feature_lines(shader, obj_set, paint_back, lines);
+            return lines;
+        }
+        const std::array<float, 4> key = { (float)shader.thickness.value_or(-1), (float)shader.crease_thickness.value_or(-1), shader.crease_angle.value_or(-1), (float)paint_back };
+        if(this->band_lines_key != key){
+            extract_feature_lines(shader, obj_set, paint_back, lines);
+            this->band_lines.assign(this->band_spans.size(), {});
+            for(const Raster::FeatureLine& line : lines){
+                const int reach = line.thickness / 2 + 3; // as paint_lines() bins them
+                const float y_lo = min((*line.start)[1], (*line.end)[1]) - reach;
+                const float y_hi = max((*line.start)[1], (*line.end)[1]) + reach;
+                for(int b = 0;b < (int)this->band_spans.size();b++){
+                    if(y_hi >= this->band_spans[b].first && y_lo < this->band_spans[b].second){ // also drops NaN
+                        this->band_lines[b].push_back(line);
+                    }
+                }
+            }
+            this->band_lines_key = key;
+        }
+        return this->band_lines[this->active_band];
     }
 
 };
@@ -11,9 +11,19 @@ namespace Raster{
     class SunLight;
 
     class SMShader;
+    struct LightSpace;
 }
 
 
+/*
+one light's view of the vertices of one Obj::ObjSet, indexed by Obj::Vertex::index, see Raster::Light::light_space()
+empty when the light cannot reach the object
+*/
+struct Raster::LightSpace{
+    std::vector<Eigen::Vector4f> position; // shadow camera clip space, before the perspective divide so it interpolates linearly
+};
+
+
 class Raster::SMShader: public Raster::Shader{
 public:
     std::function<float(Eigen::Vector3f& point_position)> get_distance;
@@ -23,8 +33,9 @@ public:
         this->get_distance = get_distance;
     }
 
-    void shade(const Obj::ObjSet* obj,
+    bool shade(const Obj::ObjSet* obj,
         const Obj::Triangle* triangle,
+        const Raster::ProjectedTriangle& projected,
         const Eigen::Vector3f bc_coord,
         const Raster::Color& fill_color,
         float* z_p,
@@ -34,16 +45,17 @@ public:
         if(!get_distance){
             throw Manga3DException("Raster::SMShader::shade(), get_distance function pointer lost");
         }
-        Eigen::Vector3f point = triangle->get_position_from_barycentric(bc_coord);
+        Eigen::Vector3f point = obj->to_world(triangle->get_position_from_barycentric(bc_coord));
         float z = -get_distance(point);
         if(z < *z_p){
-            return;
+            return false;
         }
         *z_p = z;
         if(verbose){
             Eigen::Vector3f origin(0,0,0);
             color_assign(fill_color * (-z / (get_distance(origin) * 3)), top_p);
         }
+        return true;
     }
 };
 
@@ -55,8 +67,15 @@ private:
 public:
     int index;
     float I;
+    float radius; // influence, the light is skipped at points farther than this, MAX_F reaches everywhere
     Raster::Camera camera;
-    Light(float I): I(I), camera(Raster::Color(0), 1, 1){}
+
+    static constexpr float cutoff = 1.0f / 256; // intensity under which a point light stops at its default radius
+
+    Light(float I): I(I), radius(MAX_F), camera(Raster::Color(0), 1, 1){
+        this->camera.lod_pixel_error = 0; // receivers are shaded at the main camera's level, a coarser caster would shadow them
+        this->camera.set_depth_only(true); // light_reach() only reads the shadow map depth
+    }
     virtual void config(Raster::Color& bg_color, int w, float fovY, Eigen::Vector3f& position, Eigen::Vector3f& lookat){
         throw Manga3DException("Raster::Light::config() is called, thus not doing anything.");
     }
@@ -72,6 +91,29 @@ public:
     virtual inline float get_I(float distance){
         throw Manga3DException("Raster::Light::get_I() is called, thus not doing anything.");
     }
+
+    /*
+    fills `space` with the vertices of `obj` as the shadow map sees them, for light_reach() to interpolate
+    each vertex is offset `shadow_bias` along its world space unit `normals` entry first,
+    a per-vertex stand-in for the per-fragment offset of the projected path
+    left empty when `radius` misses the object, light_reach() then skips the light as before
+    */
+    void light_space(const Obj::ObjSet* obj, const std::vector<Eigen::Vector3f>& normals, const float shadow_bias, Raster::LightSpace& space){
+        space.position.clear();
+        const float reach = this->radius + std::abs(shadow_bias);
+        if(this->radius != MAX_F && obj->bounds().distance2(this->camera.position) > reach * reach){
+            return;
+        }
+        const std::vector<Obj::Vertex*>& vertices = obj->geometry().vertices;
+        const Eigen::Matrix4f& clip = this->camera.clip_matrix();
+        space.position.resize(vertices.size());
+        parallel_for(0, vertices.size(), [&](int begin, int end){
+            for(int i = begin;i < end;i++){
+                const Eigen::Vector3f point = obj->to_world(vertices[i]->position) + normals[i] * shadow_bias;
+                space.position[i] = clip * point.homogeneous();
+            }
+        });
+    }
 };
 
 class Raster::PointLight: public Raster::Light{
@@ -80,6 +122,11 @@ public:
     void config(Raster::Color& bg_color, int w, float fovY, Eigen::Vector3f& position, Eigen::Vector3f& lookat){
         Eigen::Vector3f lookat_ = -position;
         this->camera.config(Raster::Camera::Projection::PERSP, bg_color, w, w, fovY, position, lookat_);
+        float brightest = 0;
+        for(int i = 0;i < (int)bg_color.image_color;i++){
+            maximize(brightest, bg_color.color[i]);
+        }
+        this->radius = std::sqrt(this->I * brightest / cutoff);
     }
     float get_distance(Eigen::Vector3f& point_position){
         return (this->camera.position - point_position).norm();
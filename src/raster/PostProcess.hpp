@@ -0,0 +1,481 @@
+#pragma once
+
+#include <memory>
+#include <algorithm>
+
+#include "../global.hpp"
+#include "Camera.hpp"
+
+namespace Raster{
+    class PostStage;
+    class SimpleAAStage;
+    class FXAAStage;
+    class ScreenOutlineStage;
+    class ToneStage;
+    class PostProcess;
+}
+
+
+/*
+one full-screen filter, reads `src` and writes `dst`
+src and dst are w * h * channel floats laid out like Camera::top_buff and never alias
+*/
+class Raster::PostStage{
+public:
+    virtual ~PostStage(){}
+
+    /*called once per run on the calling thread, before any apply()*/
+    virtual void prepare(const Raster::Camera& camera, const float* src){}
+
+    /*filter rows [y_begin, y_end), called concurrently on disjoint row ranges*/
+    virtual void apply(const Raster::Camera& camera, const float* src, float* dst, int y_begin, int y_end) const{
+        throw Manga3DException("Raster::PostStage apply() is called, thus not doing anything.");
+    }
+};
+
+
+/*
+cross blur, 0.5 center + 0.125 for each of the 4 neighbours, border pixels are copied
+*/
+class Raster::SimpleAAStage: public Raster::PostStage{
+public:
+    void apply(const Raster::Camera& camera, const float* src, float* dst, int y_begin, int y_end) const{
+        const int ch = (int)camera.bg_color.image_color;
+        const int stride = camera.w * ch;
+        for(int y = y_begin;y < y_end;y++){
+            const float* row = src + y * stride;
+            float* out = dst + y * stride;
+            if(y == 0 || y == camera.h - 1 || camera.w < 3){
+                std::copy(row, row + stride, out);
+                continue;
+            }
+            const int n = (camera.w - 2) * ch;
+            Eigen::Map<const Eigen::ArrayXf> center(row + ch, n);
+            Eigen::Map<const Eigen::ArrayXf> left(row, n);
+            Eigen::Map<const Eigen::ArrayXf> right(row + 2 * ch, n);
+            Eigen::Map<const Eigen::ArrayXf> up(row - stride + ch, n);
+            Eigen::Map<const Eigen::ArrayXf> down(row + stride + ch, n);
+            Eigen::Map<Eigen::ArrayXf>(out + ch, n) = center * 0.5f + (left + right + up + down) * 0.125f;
+            std::copy(row, row + ch, out);
+            std::copy(row + stride - ch, row + stride, out + stride - ch);
+        }
+    }
+};
+
+
+/*
+fast approximate anti-aliasing, blends along the local luma gradient
+luma is computed once per run in prepare()
+*/
+class Raster::FXAAStage: public Raster::PostStage{
+public:
+    float span_max;
+    float reduce_mul;
+    float reduce_min;
+
+    FXAAStage(float span_max = 8, float reduce_mul = 1.0 / 8, float reduce_min = 1.0 / 128):
+        span_max(span_max), reduce_mul(reduce_mul), reduce_min(reduce_min){}
+
+    void prepare(const Raster::Camera& camera, const float* src){
+        const int ch = (int)camera.bg_color.image_color;
+        const int wh = camera.w * camera.h;
+        luma.resize(wh);
+        parallel_for(0, camera.h, [&](int y_begin, int y_end){
+            int n = (y_end - y_begin) * camera.w;
+            int offset = y_begin * camera.w;
+            Eigen::Map<Eigen::ArrayXf> l(luma.data() + offset, n);
+            if(ch >= 3){ // BGR(A)
+                Eigen::Map<const Eigen::ArrayXf, 0, Eigen::InnerStride<>> b(src + offset * ch, n, Eigen::InnerStride<>(ch));
+                Eigen::Map<const Eigen::ArrayXf, 0, Eigen::InnerStride<>> g(src + offset * ch + 1, n, Eigen::InnerStride<>(ch));
+                Eigen::Map<const Eigen::ArrayXf, 0, Eigen::InnerStride<>> r(src + offset * ch + 2, n, Eigen::InnerStride<>(ch));
+                l = r * 0.299f + g * 0.587f + b * 0.114f;
+            }
+            else{
+                l = Eigen::Map<const Eigen::ArrayXf, 0, Eigen::InnerStride<>>(src + offset * ch, n, Eigen::InnerStride<>(ch));
+            }
+        });
+    }
+
+    void apply(const Raster::Camera& camera, const float* src, float* dst, int y_begin, int y_end) const{
+        const int ch = (int)camera.bg_color.image_color;
+        const int w = camera.w;
+        const int h = camera.h;
+        float a[4], b[4], c[4], d[4];
+        for(int y = y_begin;y < y_end;y++){
+            for(int x = 0;x < w;x++){
+                float* out = dst + (x + y * w) * ch;
+                float l_m = luma_at(x, y, w, h);
+                float l_nw = luma_at(x - 1, y - 1, w, h);
+                float l_ne = luma_at(x + 1, y - 1, w, h);
+                float l_sw = luma_at(x - 1, y + 1, w, h);
+                float l_se = luma_at(x + 1, y + 1, w, h);
+                float l_min = min(l_m, min(l_nw, l_ne), min(l_sw, l_se));
+                float l_max = max(l_m, max(l_nw, l_ne), max(l_sw, l_se));
+                if(l_max - l_min < reduce_min){
+                    std::copy(src + (x + y * w) * ch, src + (x + y * w + 1) * ch, out);
+                    continue;
+                }
+
+                float dir_x = -((l_nw + l_ne) - (l_sw + l_se));
+                float dir_y = ((l_nw + l_sw) - (l_ne + l_se));
+                float dir_reduce = max((l_nw + l_ne + l_sw + l_se) * (0.25f * reduce_mul), reduce_min);
+                float rcp_dir_min = 1 / (min(std::abs(dir_x), std::abs(dir_y)) + dir_reduce);
+                dir_x = std::clamp(dir_x * rcp_dir_min, -span_max, span_max);
+                dir_y = std::clamp(dir_y * rcp_dir_min, -span_max, span_max);
+
+                sample(src, w, h, ch, x + dir_x * (1.0f / 3 - 0.5f), y + dir_y * (1.0f / 3 - 0.5f), a);
+                sample(src, w, h, ch, x + dir_x * (2.0f / 3 - 0.5f), y + dir_y * (2.0f / 3 - 0.5f), b);
+                sample(src, w, h, ch, x - dir_x * 0.5f, y - dir_y * 0.5f, c);
+                sample(src, w, h, ch, x + dir_x * 0.5f, y + dir_y * 0.5f, d);
+                for(int i = 0;i < ch;i++){
+                    a[i] = (a[i] + b[i]) * 0.5f;
+                    b[i] = a[i] * 0.5f + (c[i] + d[i]) * 0.25f;
+                }
+                float l_b = ch >= 3 ? b[2] * 0.299f + b[1] * 0.587f + b[0] * 0.114f : b[0];
+                const float* result = (l_b < l_min || l_b > l_max) ? a : b;
+                std::copy(result, result + ch, out);
+            }
+        }
+    }
+
+private:
+    std::vector<float> luma;
+
+    inline float luma_at(int x, int y, int w, int h) const{
+        x = std::clamp(x, 0, w - 1);
+        y = std::clamp(y, 0, h - 1);
+        return luma[x + y * w];
+    }
+    static inline void sample(const float* src, int w, int h, int ch, float fx, float fy, float* result){
+        fx = std::clamp(fx, 0.0f, w - 1.0f);
+        fy = std::clamp(fy, 0.0f, h - 1.0f);
+        int x0 = (int)fx;
+        int y0 = (int)fy;
+        int x1 = x0 + 1 < w ? x0 + 1 : x0;
+        int y1 = y0 + 1 < h ? y0 + 1 : y0;
+        float tx = fx - x0;
+        float ty = fy - y0;
+        const float* p00 = src + (x0 + y0 * w) * ch;
+        const float* p10 = src + (x1 + y0 * w) * ch;
+        const float* p01 = src + (x0 + y1 * w) * ch;
+        const float* p11 = src + (x1 + y1 * w) * ch;
+        for(int i = 0;i < ch;i++){
+            float top = p00[i] + (p10[i] - p00[i]) * tx;
+            float bottom = p01[i] + (p11[i] - p01[i]) * tx;
+            result[i] = top + (bottom - top) * ty;
+        }
+    }
+};
+
+
+/*
+outlines from framebuffer discontinuities instead of mesh edges,
+cost is per pixel and independent of triangle count
+needs Camera::normal_buff and Camera::id_buff, filled by Camera::paint() for Shader::OutlineMode::SCREEN
+
+a pixel is an outline pixel when a 4-neighbour belongs to another object or lies
+farther than `depth_threshold` (relative linear depth), it is a crease pixel when the
+face normals of a neighbour differ by more than crease_angle
+both masks are dilated to thickness / crease_thickness with separable box filters
+*/
+class Raster::ScreenOutlineStage: public Raster::PostStage{
+public:
+    int thickness;
+    float crease_angle;
+    int crease_thickness;
+    Raster::Color line_color;
+    float depth_threshold;
+
+    ScreenOutlineStage(int thickness, float crease_angle, int crease_thickness, const Raster::Color& line_color, float depth_threshold = 0.03):
+        thickness(thickness), crease_angle(crease_angle), crease_thickness(crease_thickness), line_color(line_color), depth_threshold(depth_threshold){}
+    ScreenOutlineStage(const Raster::Shader& shader, float depth_threshold = 0.03): line_color(shader.line_color.value_or(Raster::Color(0))), depth_threshold(depth_threshold){
+        try{
+            thickness = shader.thickness.value();
+            crease_angle = shader.crease_angle.value();
+            crease_thickness = shader.crease_thickness.value();
+            line_color = shader.line_color.value();
+        }
+        catch(const std::bad_optional_access& e){
+            throw Manga3DException("Raster::ScreenOutlineStage(): shader thickness, crease_angle, crease_thickness or line_color empty", e);
+        }
+    }
+
+    void prepare(const Raster::Camera& camera, const float* src){
+        if(!camera.normal_buff || !camera.id_buff){
+            throw Manga3DException("Raster::ScreenOutlineStage::prepare(): camera normal_buff or id_buff empty");
+        }
+        if(line_color.image_color != camera.bg_color.image_color){
+            throw Manga3DException("Raster::ScreenOutlineStage::prepare(): line_color does not match camera color");
+        }
+        const int w = camera.w;
+        const int h = camera.h;
+        const float cos_crease = std::cos(crease_angle);
+        outline_h.resize(w * h);
+        crease_h.resize(w * h);
+        depth.resize(w * h);
+        parallel_for(0, h, [&](int y_begin, int y_end){
+            for(int i = y_begin * w;i < y_end * w;i++){
+                depth[i] = camera.id_buff[i] ? camera.linear_depth(camera.z_buff[i]) : MAX_F;
+            }
+        }, 16);
+        parallel_for(0, h, [&](int y_begin, int y_end){
+            std::vector<unsigned char> outline(w), crease(w);
+            for(int y = y_begin;y < y_end;y++){
+                for(int x = 0;x < w;x++){
+                    int p = x + y * w;
+                    int id = camera.id_buff[p];
+                    unsigned char is_outline = 0, is_crease = 0;
+                    if(id){
+                        const float* n = camera.normal_buff + p * 3;
+                        float d = depth[p];
+                        const int neighbours[4] = { x > 0 ? p - 1 : p, x < w - 1 ? p + 1 : p, y > 0 ? p - w : p, y < h - 1 ? p + w : p };
+                        for(int k = 0;k < 4;k++){
+                            int q = neighbours[k];
+                            float dq = depth[q];
+                            is_outline |= (camera.id_buff[q] != id && dq >= d);
+                            is_outline |= (dq - d > depth_threshold * d);
+                            const float* nq = camera.normal_buff + q * 3;
+                            is_crease |= (n[0] * nq[0] + n[1] * nq[1] + n[2] * nq[2] < cos_crease);
+                        }
+                    }
+                    outline[x] = is_outline;
+                    crease[x] = is_crease & !is_outline;
+                }
+                dilate_row(outline.data(), outline_h.data() + y * w, w, thickness);
+                dilate_row(crease.data(), crease_h.data() + y * w, w, crease_thickness);
+            }
+        }, 16);
+    }
+
+    void apply(const Raster::Camera& camera, const float* src, float* dst, int y_begin, int y_end) const{
+        const int ch = (int)camera.bg_color.image_color;
+        const int w = camera.w;
+        const int h = camera.h;
+        std::vector<float> mask(w);
+        for(int y = y_begin;y < y_end;y++){
+            std::fill(mask.begin(), mask.end(), 0.0f);
+            dilate_column(outline_h, mask.data(), w, h, y, thickness);
+            dilate_column(crease_h, mask.data(), w, h, y, crease_thickness);
+            const float* row = src + y * w * ch;
+            float* out = dst + y * w * ch;
+            for(int c = 0;c < ch;c++){
+                const float line = line_color.color[c];
+                for(int x = 0;x < w;x++){
+                    float v = row[x * ch + c];
+                    out[x * ch + c] = v + mask[x] * (line - v);
+                }
+            }
+        }
+    }
+
+private:
+    std::vector<unsigned char> outline_h; // horizontally dilated masks
+    std::vector<unsigned char> crease_h;
+    std::vector<float> depth;
+
+    /*pixel p is covered by a stroke of width t centered on e when p - e lies in [-(t - 1) / 2, t / 2]*/
+    static inline void dilate_row(const unsigned char* mask, unsigned char* out, int w, int t){
+        int lo = -(t - 1) / 2;
+        int hi = t / 2;
+        for(int x = 0;x < w;x++){
+            unsigned char v = 0;
+            for(int k = x - hi;k <= x - lo;k++){
+                v |= (k >= 0 && k < w) ? mask[k] : 0;
+            }
+            out[x] = v;
+        }
+    }
+    static inline void dilate_column(const std::vector<unsigned char>& mask, float* out, int w, int h, int y, int t){
+        int lo = -(t - 1) / 2;
+        int hi = t / 2;
+        for(int k = y - hi;k <= y - lo;k++){
+            if(k < 0 || k >= h){
+                continue;
+            }
+            const unsigned char* row = mask.data() + k * w;
+            for(int x = 0;x < w;x++){
+                out[x] = max(out[x], (float)row[x]);
+            }
+        }
+    }
+};
+
+
+/*
+manga screentone and hatching from Camera::shade_buff (paint with Camera::track_shade)
+a pixel is inked where its darkness, 255 - shade, exceeds a tileable threshold pattern indexed in screen space,
+so tones stay fixed to the page like printed screentone, also across the bands of Camera::paint_bands()
+the pattern is built in the constructor and tiled to the frame width in prepare(),
+apply() compares and blends whole rows as Eigen array expressions, one branch-free pass per frame
+*/
+class Raster::ToneStage: public Raster::PostStage{
+public:
+    enum class Pattern{
+        DOTS, // clustered dots on a 45 degree grid
+        LINES, // diagonal hatching
+        CROSSHATCH // hatching in the lighter half of the darkness range, crossed in the darker half
+    };
+
+    Pattern pattern;
+    int period; // pattern cell in pixels
+    Raster::Color ink;
+
+    ToneStage(Pattern pattern = Pattern::DOTS, int period = 6, const Raster::Color& ink = Raster::Color(0)): pattern(pattern), period(period > 1 ? period : 2), ink(ink){
+        const int n = this->period;
+        tile.resize(n * n);
+        if(pattern == Pattern::DOTS){
+            // rank order of the spot function, so the inked fraction of a cell follows the darkness
+            std::vector<float> spot(n * n);
+            std::vector<int> order(n * n);
+            for(int i = 0;i < n * n;i++){
+                float u = (i % n + 0.5f) / n;
+                float v = (i / n + 0.5f) / n;
+                spot[i] = std::cos(2 * PI * (u + v)) + std::cos(2 * PI * (u - v));
+                order[i] = i;
+            }
+            std::stable_sort(order.begin(), order.end(), [&spot](int a, int b){
+                return spot[a] > spot[b];
+            });
+            for(int r = 0;r < n * n;r++){
+                tile[order[r]] = (r + 0.5f) / (n * n);
+            }
+        }
+        else{
+            for(int y = 0;y < n;y++){
+                for(int x = 0;x < n;x++){
+                    float down = line_threshold(x + y, n);
+                    float up = line_threshold(x - y, n);
+                    tile[x + y * n] = pattern == Pattern::LINES ? down : min(down * 0.5f, 0.5f + up * 0.5f);
+                }
+            }
+        }
+    }
+
+    void prepare(const Raster::Camera& camera, const float* src){
+        const int w = camera.w;
+        if((int)camera.shade_buff.size() != w * camera.h){
+            throw Manga3DException("Raster::ToneStage::prepare(): camera shade_buff empty, paint with track_shade");
+        }
+        if(ink.image_color != camera.bg_color.image_color){
+            throw Manga3DException("Raster::ToneStage::prepare(): ink does not match camera color");
+        }
+        const int ch = (int)ink.image_color;
+        if((int)thresholds.size() != period * w){
+            thresholds.resize(period * w);
+            for(int y = 0;y < period;y++){
+                for(int x = 0;x < w;x++){
+                    thresholds[x + y * w] = tile[x % period + y * period] * 255;
+                }
+            }
+        }
+        ink_row.resize(w * ch);
+        for(int x = 0;x < w;x++){
+            std::copy(ink.color, ink.color + ch, ink_row.data() + x * ch);
+        }
+    }
+
+    void apply(const Raster::Camera& camera, const float* src, float* dst, int y_begin, int y_end) const{
+        const int ch = (int)camera.bg_color.image_color;
+        const int w = camera.w;
+        Eigen::ArrayXf mask(w);
+        Eigen::ArrayXXf mask_ch(ch, w);
+        Eigen::Map<const Eigen::ArrayXf> ink_px(ink_row.data(), w * ch);
+        for(int y = y_begin;y < y_end;y++){
+            const uint8_t* shade = camera.shade_buff.data() + y * w;
+            const float* threshold = thresholds.data() + ((y + camera.band_y) % period) * w;
+            for(int x = 0;x < w;x++){
+                mask[x] = 255 - shade[x] > threshold[x] ? 1.0f : 0.0f;
+            }
+            mask_ch = mask.transpose().replicate(ch, 1);
+            Eigen::Map<const Eigen::ArrayXf> in(src + y * w * ch, w * ch);
+            Eigen::Map<Eigen::ArrayXf>(dst + y * w * ch, w * ch) = in + Eigen::Map<const Eigen::ArrayXf>(mask_ch.data(), w * ch) * (ink_px - in);
+        }
+    }
+
+private:
+    std::vector<float> tile; // period * period thresholds in (0, 1]
+    std::vector<float> thresholds; // `tile` in shade_buff steps repeated across the frame width, one row per pattern row
+    std::vector<float> ink_row; // w pixels of `ink`
+
+    /*hatch line through diagonal index 0 mod n, thresholds grow with the distance to it*/
+    static inline float line_threshold(int diagonal, int n){
+        int p = ((diagonal % n) + n) % n;
+        int d = p < n - p ? p : n - p;
+        return (2.0f * d + 1) / (n + 1);
+    }
+};
+
+
+/*
+ordered list of PostStage run over Camera::top_buff
+each stage reads the current buffer and writes the back buffer, then the two are swapped,
+so no stage ever reads pixels it has already written
+rows are split across worker threads
+
+heap data inside
+*/
+class Raster::PostProcess{
+private:
+    PostProcess(const PostProcess& other);
+    PostProcess& operator=(const PostProcess& other);
+
+    float* back_buff;
+    int back_size;
+
+    void ensure_back_buff(const Raster::Camera& camera){
+        int size = camera.w * camera.h * (int)camera.bg_color.image_color;
+        if(back_buff && back_size == size){
+            return;
+        }
+        if(back_buff){
+            delete[] back_buff;
+        }
+        back_buff = new float[size];
+        back_size = size;
+    }
+
+public:
+    std::vector<std::unique_ptr<Raster::PostStage>> stages;
+
+    PostProcess(): back_buff(nullptr), back_size(0){}
+    ~PostProcess(){
+        if(back_buff){
+            delete[] back_buff;
+            back_buff = nullptr;
+        }
+    }
+
+    inline void add_stage(std::unique_ptr<Raster::PostStage> stage){
+        stages.push_back(std::move(stage));
+    }
+    inline void clear(){
+        stages.clear();
+    }
+
+    /*
+    the back buffer and camera.top_buff are swapped, not copied,
+    so camera.top_buff may point at a different allocation afterwards
+    compact camera buffers are expanded to floats first, see Raster::Camera::expand_buffs()
+    */
+    void apply(Raster::Camera& camera, Raster::PostStage& stage){
+        camera.expand_buffs();
+        if(!camera.top_buff){
+            throw Manga3DException("Raster::PostProcess::apply(): camera top_buff empty");
+        }
+        auto t0 = std::chrono::steady_clock::now();
+        ensure_back_buff(camera);
+        stage.prepare(camera, camera.top_buff);
+        const float* src = camera.top_buff;
+        float* dst = back_buff;
+        parallel_for(0, camera.h, [&](int y_begin, int y_end){
+            stage.apply(camera, src, dst, y_begin, y_end);
+        }, 16);
+        std::swap(camera.top_buff, back_buff);
+        camera.stats.post_ms += elapsed_ms(t0);
+    }
+    void run(Raster::Camera& camera){
+        for(std::unique_ptr<Raster::PostStage>& stage : stages){
+            apply(camera, *stage);
+        }
+    }
+};
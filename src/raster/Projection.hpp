@@ -0,0 +1,187 @@
+#pragma once
+
+#include "../global.hpp"
+#include "../obj/OBJ.hpp"
+
+namespace Raster{
+    class ProjectedTriangle;
+    class TriangleEdges;
+    class ProjectedMesh;
+}
+
+
+/*
+screen-space corners and normal of one triangle as seen by one camera
+references point into a Raster::ProjectedMesh
+*/
+class Raster::ProjectedTriangle{
+public:
+    const Eigen::Vector3f& A;
+    const Eigen::Vector3f& B;
+    const Eigen::Vector3f& C;
+    const Eigen::Vector3f& normal; // projected space
+
+    ProjectedTriangle(const Eigen::Vector3f& A, const Eigen::Vector3f& B, const Eigen::Vector3f& C, const Eigen::Vector3f& normal): A(A), B(B), C(C), normal(normal){}
+
+    inline bool is_inside_triangle(float x, float y) const{
+        float ax, ay, bx, by, cx, cy;
+        ax = A[0] - x;
+        ay = A[1] - y;
+        bx = B[0] - x;
+        by = B[1] - y;
+        cx = C[0] - x;
+        cy = C[1] - y;
+        float v0, v1, v2;
+        v0 = ax * by - ay * bx;
+        v1 = bx * cy - by * cx;
+        v2 = cx * ay - cy * ax;
+        return (v0 < EPSILON && v1 < EPSILON && v2 < EPSILON) || (v0 > -EPSILON && v1 > -EPSILON && v2 > -EPSILON);
+    }
+    inline Eigen::Vector3f get_barycentric_coordinate(float x, float y) const{
+        float alpha, beta, gama;
+        alpha = (-(x - B[0]) * (C[1] - B[1]) + (y - B[1]) * (C[0] - B[0])) / (-(A[0] - B[0]) * (C[1] - B[1]) + (A[1] - B[1]) * (C[0] - B[0]));
+        beta = (-(x - C[0]) * (A[1] - C[1]) + (y - C[1]) * (A[0] - C[0])) / (-(B[0] - C[0]) * (A[1] - C[1]) + (B[1] - C[1]) * (A[0] - C[0]));
+        gama = 1 - alpha - beta;
+        return Eigen::Vector3f(alpha, beta, gama);
+    }
+    /*interpolated projected depth, larger is closer*/
+    inline float get_z(const Eigen::Vector3f& bc_coord) const{
+        return bc_coord.dot(Eigen::Vector3f(A[2], B[2], C[2]));
+    }
+};
+
+
+/*
+fixed-point edge functions of a Raster::ProjectedTriangle for watertight coverage
+corners are snapped to 1 / 2^SUBPIXEL_BITS pixel and the edge functions are evaluated exactly in integers,
+a sample on an edge belongs to the triangle only when it is a top or left edge,
+so triangles sharing an edge cover each sample exactly once whatever their winding
+corners too far off screen for the integer range fall back to `ProjectedTriangle::is_inside_triangle()`
+*/
+class Raster::TriangleEdges{
+public:
+    static const int SUBPIXEL_BITS = 8;
+    static constexpr float MAX_COORD = 1 << 22; // pixels, keeps every edge value within int64_t
+
+    bool fixed; // false when the float test is used instead
+    bool empty; // degenerate, covers nothing
+
+    TriangleEdges(const Raster::ProjectedTriangle& triangle): fixed(false), empty(false), triangle(triangle), a{ 0, 0, 0 }, b{ 0, 0, 0 }, c{ 0, 0, 0 }{
+        const Eigen::Vector3f* corners[3] = { &triangle.A, &triangle.B, &triangle.C };
+        int64_t x[3], y[3];
+        for(int i = 0;i < 3;i++){
+            if(!(std::abs((*corners[i])[0]) < MAX_COORD && std::abs((*corners[i])[1]) < MAX_COORD)){
+                return;
+            }
+            x[i] = to_fixed((*corners[i])[0]);
+            y[i] = to_fixed((*corners[i])[1]);
+        }
+        fixed = true;
+        // edge i is opposite corner i, positive inside for counterclockwise corners on screen
+        for(int i = 0;i < 3;i++){
+            const int j = (i + 1) % 3;
+            const int k = (i + 2) % 3;
+            a[i] = y[j] - y[k];
+            b[i] = x[k] - x[j];
+            c[i] = x[j] * y[k] - x[k] * y[j];
+        }
+        const int64_t area = a[0] * x[0] + b[0] * y[0] + c[0];
+        if(area == 0){
+            empty = true;
+            return;
+        }
+        for(int i = 0;i < 3;i++){
+            if(area < 0){
+                a[i] = -a[i];
+                b[i] = -b[i];
+                c[i] = -c[i];
+            }
+            // a sample exactly on the edge counts only when the inside lies to its right (left edge) or below it (top edge)
+            if(!(a[i] > 0 || (a[i] == 0 && b[i] > 0))){
+                c[i] -= 1;
+            }
+        }
+    }
+
+    static inline int64_t to_fixed(const float v){
+        return std::llround(v * (1 << SUBPIXEL_BITS));
+    }
+
+    /*coverage of the sample at (x, y)*/
+    inline bool covers(const float x, const float y) const{
+        if(!fixed){
+            return triangle.is_inside_triangle(x, y);
+        }
+        if(empty){
+            return false;
+        }
+        const int64_t X = to_fixed(x);
+        const int64_t Y = to_fixed(y);
+        return (a[0] * X + b[0] * Y + c[0]) >= 0 && (a[1] * X + b[1] * Y + c[1]) >= 0 && (a[2] * X + b[2] * Y + c[2]) >= 0;
+    }
+
+    /*
+    integer stepping along a row of whole pixels, `begin(x, y)` then `inside()` and `next()` per pixel
+    meaningless unless `fixed`
+    */
+    class Row{
+    public:
+        int64_t e[3];
+        int64_t step[3];
+        inline bool inside() const{
+            return (e[0] | e[1] | e[2]) >= 0;
+        }
+        inline void next(){
+            e[0] += step[0];
+            e[1] += step[1];
+            e[2] += step[2];
+        }
+    };
+    inline Row begin(const int x, const int y) const{
+        Row row;
+        const int64_t X = (int64_t)x * (1 << SUBPIXEL_BITS);
+        const int64_t Y = (int64_t)y * (1 << SUBPIXEL_BITS);
+        for(int i = 0;i < 3;i++){
+            row.e[i] = empty ? -1 : a[i] * X + b[i] * Y + c[i];
+            row.step[i] = empty ? 0 : a[i] * (1 << SUBPIXEL_BITS);
+        }
+        return row;
+    }
+
+private:
+    const Raster::ProjectedTriangle& triangle;
+    int64_t a[3];
+    int64_t b[3];
+    int64_t c[3];
+};
+
+
+/*
+one camera's projection of one Obj::ObjSet
+indexed by Obj::Vertex::index and Obj::Triangle::index, so cameras never write to the mesh
+*/
+class Raster::ProjectedMesh{
+public:
+    std::vector<Eigen::Vector3f> positions;
+    std::vector<Eigen::Vector3f> normals; // projected space, recomputed with the positions
+
+    inline const Eigen::Vector3f& position(const Obj::Vertex* vertex) const{
+        return positions[vertex->index];
+    }
+    inline const Eigen::Vector3f& normal(const Obj::Triangle* triangle) const{
+        return normals[triangle->index];
+    }
+    inline Raster::ProjectedTriangle triangle(const Obj::Triangle* triangle) const{
+        return Raster::ProjectedTriangle(positions[triangle->A->index], positions[triangle->B->index], positions[triangle->C->index], normals[triangle->index]);
+    }
+    inline void calculate_normals(const Obj::ObjSet* obj){
+        normals.resize(obj->triangles.size());
+        parallel_for(0, obj->triangles.size(), [&](int t_begin, int t_end){
+            for(int t = t_begin;t < t_end;t++){
+                const Obj::Triangle* tri = obj->triangles[t];
+                const Eigen::Vector3f& a = positions[tri->A->index];
+                normals[t] = ((positions[tri->B->index] - a).cross(a - positions[tri->C->index])).normalized();
+            }
+        }, 1024);
+    }
+};
@@ -2,10 +2,12 @@
 
 #include "../global.hpp"
 #include "../obj/OBJ.hpp"
+#include "../obj/Simplify.hpp"
 #include "../Color.hpp"
 #include "Light.hpp"
 #include "Camera.hpp"
 #include "ShaderAdv.hpp"
+#include "PostProcess.hpp"
 
 namespace Raster{
     class Rasterizer;
@@ -16,14 +18,25 @@ namespace Raster{
 heap pointer inside member
 */
 class Raster::Rasterizer{
+private:
+    Rasterizer(const Rasterizer& other);
+    Rasterizer& operator=(const Rasterizer& other);
 public:
 
     std::vector<Obj::ObjSet*> obj_set;
+    std::vector<Obj::ObjSet*> meshes; // shared by instances in `obj_set`, not painted themselves, see `load_mesh()`
 
     std::vector<Raster::Light*> lights;
     Raster::Camera camera;
+    Raster::PostProcess post_process;
+    Raster::Shader::OutlineMode outline_mode = Raster::Shader::OutlineMode::GEOMETRY;
+    bool owns_scene = true; // false for views made with Rasterizer(Rasterizer& scene, Raster::Color bg_color)
+    double bake_ms = 0; // wall time of the last shadow_bake()
 
+private:
+    std::vector<std::pair<std::string, std::string>> mesh_paths; // obj and texture path of each of `meshes`
 
+public:
     /*
     new Obj::ObjSet is allocated on the heap
         use `~ObjSet()` to delete them
@@ -31,11 +44,40 @@ public:
     inline void load_obj(const std::string obj_path, const std::string tex_path = ""){
         obj_set.push_back(new Obj::ObjSet(obj_path, tex_path));
     }
+    /*
+    mesh for `add_instance()`, each obj and texture path pair is loaded once
+    kept in `meshes` and deleted with the rasterizer
+    */
+    Obj::ObjSet* load_mesh(const std::string& obj_path, const std::string& tex_path = ""){
+        for(int m = 0;m < (int)this->meshes.size();m++){
+            if(this->mesh_paths[m].first == obj_path && this->mesh_paths[m].second == tex_path){
+                return this->meshes[m];
+            }
+        }
+        this->meshes.push_back(new Obj::ObjSet(obj_path, tex_path));
+        this->mesh_paths.emplace_back(obj_path, tex_path);
+        return this->meshes.back();
+    }
+    /*paints `mesh` once more, placed by `model`, only the matrix is stored per instance*/
+    inline void add_instance(const Obj::ObjSet* mesh, const Eigen::Matrix4f& model){
+        obj_set.push_back(new Obj::ObjSet(mesh, model));
+    }
     Rasterizer(Raster::Color bg_color = Raster::Color(0, 0)): camera(bg_color, 1, 1){}
     Rasterizer(const std::string obj_path, const std::string tex_path = "", Raster::Color bg_color = Raster::Color(0, 0)): camera(bg_color, 1, 1){
         load_obj(obj_path, tex_path);
     }
+    /*
+    another view on the objects and baked lights of `scene`, with its own camera and post-process buffers
+    nothing is copied, `scene` must outlive the view and keep its objects and lights meanwhile
+    explicit and without a default `bg_color`, so it never stands in for a copy constructor
+    */
+    explicit Rasterizer(Rasterizer& scene, Raster::Color bg_color): obj_set(scene.obj_set), lights(scene.lights), camera(bg_color, 1, 1), outline_mode(scene.outline_mode), owns_scene(false){}
     ~Rasterizer(){
+        if(!this->owns_scene){
+            this->obj_set.clear();
+            this->lights.clear();
+            return;
+        }
         for(Obj::ObjSet* obj : this->obj_set){
             if(obj){
                 obj->clear_heap();
@@ -43,6 +85,11 @@ public:
             }
         }
         this->obj_set.clear();
+        for(Obj::ObjSet* mesh : this->meshes){
+            mesh->clear_heap();
+            delete mesh;
+        }
+        this->meshes.clear();
         for(Raster::Light* light : this->lights){
             if(light){
                 delete light;
@@ -54,6 +101,50 @@ public:
     inline void config_camera(Raster::Camera::Projection projection_type, Raster::Color bg_color, int w, int h, float fovY, Eigen::Vector3f position, Eigen::Vector3f lookat_g, float up_t = 0, float near = DEFAULT_NEAR, float far = DEFAULT_FAR){
         this->camera.config(projection_type, bg_color, w, h, fovY, position, lookat_g, up_t, near, far);
     }
+    /*samples per pixel for the main camera, 1 disables multisampling*/
+    inline void set_msaa(int samples){
+        this->camera.set_msaa(samples);
+    }
+    /*paint objects and triangle clusters of the main camera nearest first, so hidden fragments fail the early depth test*/
+    inline void set_front_to_back(bool enable){
+        this->camera.front_to_back = enable;
+    }
+    /*
+    simplified levels of every object and instanced mesh for distant views, see Obj::build_lods()
+    `crease_angle` in radians, creases sharper than it keep their outline
+    */
+    void build_lods(int levels, float crease_angle = 1){
+        std::vector<Obj::ObjSet*> sources = this->meshes;
+        for(Obj::ObjSet* obj : this->obj_set){
+            if(!obj->is_instance()){
+                sources.push_back(obj);
+            }
+        }
+        parallel_for(0, sources.size(), [&](int begin, int end){
+            for(int o = begin;o < end;o++){
+                Obj::build_lods(*sources[o], levels, crease_angle);
+            }
+        }, 1);
+        for(Obj::ObjSet* obj : this->obj_set){
+            obj->link_lods();
+        }
+    }
+    /*side in pixels of the screen tiles the main camera culls lights against, 0 evaluates every light at every pixel*/
+    inline void set_light_tile(int pixels){
+        this->camera.light_tile = pixels;
+    }
+    /*side in pixels of the blocks the main camera stores depth and color in while painting, 0 keeps rows, see Camera::set_buff_tile()*/
+    inline void set_buff_tile(int pixels){
+        this->camera.set_buff_tile(pixels);
+    }
+    /*storage of the main camera's color and depth while painting, see Camera::set_formats()*/
+    inline void set_formats(Raster::Camera::ColorFormat color, Raster::Camera::DepthFormat depth){
+        this->camera.set_formats(color, depth);
+    }
+    /*screen-space error in pixels up to which the main camera paints coarser levels, 0 always paints full detail*/
+    inline void set_lod_pixel_error(float pixels){
+        this->camera.lod_pixel_error = pixels;
+    }
     inline void config_camera(float fovY, Eigen::Vector3f position, Eigen::Vector3f lookat_g){
         this->camera.config(this->camera.projection_type, this->camera.bg_color, this->camera.w, this->camera.h, fovY, position, lookat_g, 0, this->camera.near, this->camera.far);
     }
@@ -62,7 +153,8 @@ public:
         POINTLIGHT,
         SUNLIGHT
     };
-    inline void add_light(LightType light_type, float I, Raster::Color light_color, int sm_resolution, float sm_fov, Eigen::Vector3f position_lookat){
+    /*`radius` overrides the influence of a point light, 0 keeps the one where it fades under Light::cutoff*/
+    inline void add_light(LightType light_type, float I, Raster::Color light_color, int sm_resolution, float sm_fov, Eigen::Vector3f position_lookat, float radius = 0){
         Raster::Light* light;
         if(light_type == LightType::POINTLIGHT){
             light = new PointLight(I);
@@ -75,17 +167,68 @@ public:
         }
         light->index = this->lights.size();
         light->config(light_color, sm_resolution, sm_fov, position_lookat, position_lookat);
+        if(radius > 0 && light_type == LightType::POINTLIGHT){
+            light->radius = radius;
+        }
         this->lights.push_back(light);
     }
 
+    /*every light owns its shadow camera, so lights are baked concurrently*/
     void shadow_bake(bool verbose = false){
-        for(Raster::Light* light : this->lights){
-            light->cast_shadow(obj_set, verbose);
+        auto t0 = std::chrono::steady_clock::now();
+        parallel_for(0, this->lights.size(), [&](int l_begin, int l_end){
+            for(int l = l_begin;l < l_end;l++){
+                this->lights[l]->cast_shadow(obj_set, verbose && this->lights.size() == 1);
+            }
+        });
+        this->bake_ms = Raster::elapsed_ms(t0);
+        if(verbose){
+            std::cout << "End shadow_bake(): " << this->lights.size() << " lights" << std::endl;
         }
+    }
+
+    /*GEOMETRY strokes mesh feature edges, SCREEN detects outlines on the framebuffer after painting*/
+    inline void set_outline_mode(Raster::Shader::OutlineMode mode){
+        this->outline_mode = mode;
+    }
+    void paint_shader(Raster::Shader& shader, const Raster::Color& fill_color, bool paint_back, bool verbose){
+        shader.outline_mode = this->outline_mode;
+        camera.paint(shader, this->obj_set, fill_color, paint_back, verbose);
+        if(shader.do_outline && shader.outline_mode == Raster::Shader::OutlineMode::SCREEN){
+            Raster::ScreenOutlineStage outline_stage(shader);
+            post_process.apply(this->camera, outline_stage);
+        }
+    }
+
+    /*
+    paints the scene from every camera in `cameras` with one shader
+    views run concurrently, each camera keeps its own projection and buffers,
+    the meshes, load-time crease classification, decoded textures and baked shadow maps are shared
+    the shader is called from several threads and must not keep per-pixel state
+    */
+    void paint_views(const std::vector<Raster::Camera*>& cameras, Raster::Shader& shader, const Raster::Color& fill_color, bool paint_back = false, bool verbose = false){
+        shader.outline_mode = this->outline_mode;
+        const bool screen_outline = shader.do_outline && shader.outline_mode == Raster::Shader::OutlineMode::SCREEN;
+        parallel_for(0, cameras.size(), [&](int c_begin, int c_end){
+            Raster::PostProcess view_post_process;
+            for(int c = c_begin;c < c_end;c++){
+                cameras[c]->paint(shader, this->obj_set, fill_color, paint_back, false);
+                if(screen_outline){
+                    Raster::ScreenOutlineStage outline_stage(shader);
+                    view_post_process.apply(*cameras[c], outline_stage);
+                }
+            }
+        });
         if(verbose){
-            std::cout << "End shadow_bake()" << std::endl;
+            std::cout << "End paint_views(): " << cameras.size() << " views" << std::endl;
         }
     }
+    inline void paint_phoneshading_views(const std::vector<Raster::Camera*>& cameras, const Raster::Color fill_color, float shadow_bias = 0.05, bool pcf = false, bool paint_back = false, bool verbose = false){
+        Raster::Color line_color(fill_color.image_color, 0, 1);
+        DiscreteShader discrete_shader(lights, shadow_bias, pcf);
+        discrete_shader.set_outline(2, 1, 1, line_color);
+        paint_views(cameras, discrete_shader, fill_color, paint_back, verbose);
+    }
 
     inline void paint_frame_simple(Raster::Color color, bool verbose = false){
         camera.paint_frame_simple(this->obj_set, color, verbose);
@@ -95,14 +238,14 @@ public:
     }
     inline void paint_outline_simple(Raster::Color line_color, Raster::Color fill_color, int thickness = 2, float crease_angle = 1, int crease_thickness = 1, bool paint_back = false, bool verbose = false){
         Raster::OutlineShader outline_shader(thickness, crease_angle, crease_thickness, line_color);
-        camera.paint(outline_shader, this->obj_set, fill_color, paint_back, verbose);
+        paint_shader(outline_shader, fill_color, paint_back, verbose);
         if(verbose){
             std::cout << "End paint_outline_simple()" << std::endl;
         }
     }
     inline void paint_texture_simple(Raster::Color fill_color, bool paint_back = false, bool verbose = false){
         Raster::TextureShader texture_shader;
-        camera.paint(texture_shader, this->obj_set, fill_color, paint_back, verbose);
+        paint_shader(texture_shader, fill_color, paint_back, verbose);
         if(verbose){
             std::cout << "End paint_texture_simple()" << std::endl;
         }
@@ -111,23 +254,38 @@ public:
         Raster::Color line_color(fill_color.image_color,0,1);
         DiscreteShader discrete_shader(lights, shadow_bias, pcf);
         discrete_shader.set_outline(2,1,1,line_color);
-        camera.paint(discrete_shader, this->obj_set, fill_color, paint_back, verbose);
+        paint_shader(discrete_shader, fill_color, paint_back, verbose);
         if(verbose){
             std::cout << "End paint_phoneshading()" << std::endl;
         }
     }
 
-    void simple_aa(){
-        for(int y = 1; y < this->camera.h - 1;y++){
-            for(int x = 1;x < this->camera.w - 1;x++){
-                Raster::Color xy(this->camera.bg_color.image_color,this->camera.get_top_buff(x,y));
-                Raster::Color x1y(this->camera.bg_color.image_color,this->camera.get_top_buff(x+1,y));
-                Raster::Color xy1(this->camera.bg_color.image_color,this->camera.get_top_buff(x,y+1));
-                Raster::Color x0y(this->camera.bg_color.image_color,this->camera.get_top_buff(x-1,y));
-                Raster::Color xy0(this->camera.bg_color.image_color,this->camera.get_top_buff(x,y-1));
-                Raster::Color result = xy * 0.5 + x1y * 0.125 + xy1 * 0.125 + x0y * 0.125 + xy0 * 0.125; 
-                color_assign(result,this->camera.get_top_buff(x,y));
-            }
-        }
+    /*
+    an image of `frame_h` rows painted `band_rows` at a time by the main camera, see Camera::paint_bands()
+    `band(top, y, rows)` paints the band with one of the paint_ methods, post-processes it and takes its rows
+    */
+    inline void paint_bands(int frame_h, int band_rows, int apron, const std::function<void(int top, int y, int rows)>& band){
+        this->camera.paint_bands(this->obj_set, frame_h, band_rows, apron, band);
+    }
+
+    /*stats of the last paint of the main camera, with post-processing since and this rasterizer's shadow bake*/
+    inline Raster::RenderStats render_stats() const{
+        Raster::RenderStats stats = this->camera.stats;
+        stats.bake_ms = this->bake_ms;
+        return stats;
+    }
+
+    inline void simple_aa(){
+        Raster::SimpleAAStage stage;
+        post_process.apply(this->camera, stage);
+    }
+    inline void fxaa(){
+        Raster::FXAAStage stage;
+        post_process.apply(this->camera, stage);
+    }
+    /*screentone or hatching over the shaded areas, the camera must have painted with track_shade*/
+    inline void tone(Raster::ToneStage::Pattern pattern, int period, const Raster::Color& ink){
+        Raster::ToneStage stage(pattern, period, ink);
+        post_process.apply(this->camera, stage);
     }
 };
@@ -2,21 +2,63 @@
 
 #include "../global.hpp"
 #include "../Color.hpp"
+#include "Projection.hpp"
 
 namespace Raster{
     class Shader;
+
+    /*
+    light reaching the fragment last shaded on this thread, 0 dark to 1 fully lit
+    set by light_reach(), reset to 1 by Camera::paint() before each shade() while Camera::track_shade,
+    so unlit shaders leave their fragments at 1
+    */
+    inline float& fragment_light(){
+        thread_local float light = 1;
+        return light;
+    }
+
+    /*a light as Camera::paint() culls it, `index` into the shader's light list*/
+    struct LightSphere{
+        int index;
+        Eigen::Vector3f center;
+        float radius; // MAX_F for lights that reach every tile
+    };
+
+    /*
+    indices of the lights that can reach the fragment shaded on this thread, nullptr for all of them
+    set by Camera::paint() from its light tiles, read by light_reach()
+    */
+    inline const std::vector<int>*& tile_lights(){
+        thread_local const std::vector<int>* lights = nullptr;
+        return lights;
+    }
 }
 
 class Raster::Shader{
 public:
+    enum class OutlineMode{
+        GEOMETRY, // feature edges stroked with Camera::paint_line_simple
+        SCREEN // depth, normal and object id discontinuities, see Raster::ScreenOutlineStage
+    };
+
     bool do_outline;
+    OutlineMode outline_mode;
+    bool early_z; // shade() begins with the depth test of `projected.get_z()`, so Camera::paint() may run it first and skip the call
     std::optional<int> thickness;
     std::optional<float> crease_angle;
     std::optional<int> crease_thickness;
     std::optional<Raster::Color> line_color;
 
-    virtual void shade(const Obj::ObjSet* obj,
+    Shader(): do_outline(false), outline_mode(OutlineMode::GEOMETRY), early_z(false){}
+    virtual ~Shader(){}
+
+    /*
+    depth tests the fragment against `*z_p` and, when it passes, writes its depth and color,
+    true when it wrote, a fragment at exactly the stored depth also passes and overwrites
+    */
+    virtual bool shade(const Obj::ObjSet* obj,
         const Obj::Triangle* triangle,
+        const Raster::ProjectedTriangle& projected,
         const Eigen::Vector3f bc_coord,
         const Raster::Color& fill_color,
         float* z_p,
@@ -26,6 +68,13 @@ public:
         throw Manga3DException("Raster::Shader shade() is called, thus not doing anything.");
     }
 
+    /*after Camera::paint(), top_buff is nullptr while the camera keeps a compact color format*/
     virtual void post_shade(float* top_buff){}
+
+    /*called by Camera::paint() on its thread before the triangles of `obj` are shaded, for per-object setup*/
+    virtual void begin_object(const Obj::ObjSet* obj){}
+
+    /*lights shade() may evaluate, Camera::paint() bins them into screen tiles when any has a finite radius*/
+    virtual void light_spheres(std::vector<Raster::LightSphere>& spheres) const{}
 };
 
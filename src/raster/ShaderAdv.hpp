@@ -15,6 +15,7 @@ namespace Raster{
 class Raster::OutlineShader: public Raster::Shader{
 public:
     OutlineShader(int thickness, float crease_angle, int crease_thickness, Raster::Color& line_color): Shader(){
+        this->early_z = true;
         this->do_outline = true;
         this->thickness = thickness;
         this->crease_angle = crease_angle;
@@ -22,26 +23,29 @@ public:
         this->line_color = line_color;
     }
 
-    void shade(const Obj::ObjSet* obj,
+    bool shade(const Obj::ObjSet* obj,
         const Obj::Triangle* triangle,
+        const Raster::ProjectedTriangle& projected,
         const Eigen::Vector3f bc_coord,
         const Raster::Color& fill_color,
         float* z_p,
         float* top_p,
         const bool verbose){
 
-        float z = bc_coord.dot(Eigen::Vector3f(triangle->A->projected_position[2], triangle->B->projected_position[2], triangle->C->projected_position[2]));
+        float z = projected.get_z(bc_coord);
         if(z > 0 || z < *z_p){
-            return;
+            return false;
         }
         *z_p = z;
         color_assign(fill_color, top_p);
+        return true;
     }
 };
 
 class Raster::TextureShader: public Raster::Shader{
 public:
     TextureShader(): Shader(){
+        this->early_z = true;
         this->do_outline = false;
     }
 
@@ -53,53 +57,136 @@ public:
         this->line_color = line_color;
     }
 
-    void shade(const Obj::ObjSet* obj,
+    bool shade(const Obj::ObjSet* obj,
         const Obj::Triangle* triangle,
+        const Raster::ProjectedTriangle& projected,
         const Eigen::Vector3f bc_coord,
         const Raster::Color& fill_color,
         float* z_p,
         float* top_p,
         const bool verbose){
 
-        float z = bc_coord.dot(Eigen::Vector3f(triangle->A->projected_position[2], triangle->B->projected_position[2], triangle->C->projected_position[2]));
+        float z = projected.get_z(bc_coord);
         if(z > 0 || z < *z_p){
-            return;
+            return false;
         }
         *z_p = z;
         Raster::Color color = get_texture_color(fill_color, obj, triangle, bc_coord);
         color_assign(color, top_p);
+        return true;
     }
 };
 
+/*
+`sum` += `light_color` * `I` * `cos`, Raster::Color arithmetic without its temporaries
+only the color channels are scaled, alpha is added as is
+*/
+inline void accumulate_light(Raster::Color& sum, const Raster::Color& light_color, const float I, const float cos){
+    if(sum.image_color != light_color.image_color){
+        throw Manga3DException("Unmatch Raster::Color(" + imgcolor_2_string(sum.image_color) + ") + Raster::Color(" + imgcolor_2_string(light_color.image_color) + ")");
+    }
+    const int channels = (int)light_color.image_color;
+    const int scaled = (light_color.image_color == Raster::Color::ImageColor::BLACKWHITE || light_color.image_color == Raster::Color::ImageColor::BLACKWHITEALPHA) ? 1 : 3;
+    for(int i = 0;i < channels;i++){
+        sum.color[i] += i < scaled ? light_color.color[i] * I * cos : light_color.color[i];
+    }
+}
+
+namespace Raster{
+    /*per-vertex light space of the object shaded on this thread, one entry per light, see `begin_light_space()`*/
+    struct ObjectLightSpace{
+        const Obj::ObjSet* obj = nullptr; // nullptr while fragments are projected into every shadow map
+        std::vector<Eigen::Vector3f> normals;
+        std::vector<Raster::LightSpace> lights;
+    };
+    inline ObjectLightSpace& object_light_space(){
+        thread_local ObjectLightSpace space;
+        return space;
+    }
+}
+
+/*
+fills Raster::object_light_space() for `obj`, so light_reach() interpolates shadow map coordinates
+from its vertices instead of projecting each fragment, nullptr `obj` goes back to projecting
+light distances stay per fragment, a point light's is not linear across a triangle
+vertices are offset along their normal averaged over their faces, which only approximates the per-fragment shadow bias
+*/
+void begin_light_space(const std::vector<Raster::Light*>& lights, const Obj::ObjSet* obj, const float shadow_bias){
+    Raster::ObjectLightSpace& space = Raster::object_light_space();
+    space.obj = obj;
+    if(!obj){
+        return;
+    }
+    const Obj::ObjSet& geometry = obj->geometry();
+    space.normals.assign(geometry.vertices.size(), Eigen::Vector3f::Zero());
+    for(const Obj::Triangle* triangle : geometry.triangles){
+        // area weighted and facing out of counterclockwise faces, unlike Obj::Triangle::face_normal
+        const Eigen::Vector3f normal = (triangle->B->position - triangle->A->position).cross(triangle->C->position - triangle->A->position);
+        for(const Obj::Vertex* vertex : { triangle->A, triangle->B, triangle->C }){
+            space.normals[vertex->index] += normal;
+        }
+    }
+    for(Eigen::Vector3f& normal : space.normals){
+        normal = obj->normal_to_world(normal).normalized();
+    }
+    space.lights.resize(lights.size());
+    for(int k = 0;k < (int)lights.size();k++){
+        lights[k]->light_space(obj, space.normals, shadow_bias, space.lights[k]);
+    }
+}
+
 Raster::Color light_reach(
     const std::vector<Raster::Light*>& lights,
+    const Obj::ObjSet* obj,
     const Obj::Triangle* triangle,
+    const Raster::ProjectedTriangle& projected,
     const Raster::Color& fill_color,
     const Eigen::Vector3f bc_coord,
     const float shadow_bias,
     const bool pcf){
 
-    Eigen::Vector3f point = triangle->get_position_from_barycentric(bc_coord);
+    Eigen::Vector3f point = obj->to_world(triangle->get_position_from_barycentric(bc_coord));
     Eigen::Vector3f normal;
     if(triangle->is_smooth){
-        normal = triangle->get_normal_from_barycentric(bc_coord);
+        normal = obj->normal_to_world(triangle->get_normal_from_barycentric(bc_coord));
     }
     else{
-        try{
-            normal = triangle->normal.value();
-        }
-        catch(const std::bad_optional_access& e){
-            throw Manga3DException("Raster::PhoneShader::shade(): triangle normal lost", e);
-        }
+        normal = projected.normal;
     }
     normal.normalize();
     point += normal * shadow_bias;
     Raster::Color light_sum(fill_color.image_color, 0.1, 1);
-    for(Raster::Light* light : lights){
+    Raster::RenderStats* stats = Raster::active_stats();
+    const std::vector<int>* tile = Raster::tile_lights();
+    const Raster::ObjectLightSpace& space = Raster::object_light_space();
+    const bool interpolated = (space.obj == obj);
+    const int a = triangle->A->index;
+    const int b = triangle->B->index;
+    const int c = triangle->C->index;
+    const int n = tile ? tile->size() : lights.size();
+    for(int k = 0;k < n;k++){
+        const int l = tile ? (*tile)[k] : k;
+        Raster::Light* light = lights[l];
+        const Raster::LightSpace* vertices = interpolated ? &space.lights[l] : nullptr;
+        if(vertices && vertices->position.empty()){ // out of reach of the whole object
+            continue;
+        }
         bool shadowed = false;
         float light_dist = -light->get_distance(point);
-        Eigen::Vector3f projected_point = point;
-        light->camera.projection(projected_point);
+        if(-light_dist > light->radius){
+            continue;
+        }
+        if(stats){
+            stats->shadow_lookups += pcf ? 9 : 1;
+        }
+        Eigen::Vector3f projected_point;
+        if(vertices){
+            projected_point = (bc_coord[0] * vertices->position[a] + bc_coord[1] * vertices->position[b] + bc_coord[2] * vertices->position[c]).hnormalized();
+        }
+        else{
+            projected_point = point;
+            light->camera.projection(projected_point);
+        }
         if(!pcf){
             float* light_z = light->camera.get_z_buff(projected_point);
             if(light_z && *light_z > light_dist){
@@ -123,21 +210,30 @@ Raster::Color light_reach(
             }
         }
         if(!shadowed){
-            Raster::Color light_color = (light->camera.bg_color * (light->get_I(light_dist)));
-            light_color *= max(0, normal.dot(light->get_l(point)));
-            light_sum += light_color;
+            accumulate_light(light_sum, light->camera.bg_color, light->get_I(light_dist), max(0, normal.dot(light->get_l(point))));
         }
     }
+    Raster::fragment_light() = min(max(light_sum.luma(), 0), 1);
     return light_sum;
 }
 
+/*`lights` for the tiled culling of Camera::paint(), grown by the shadow bias light_reach() offsets points by*/
+void light_spheres(const std::vector<Raster::Light*>& lights, const float shadow_bias, std::vector<Raster::LightSphere>& spheres){
+    for(int k = 0;k < (int)lights.size();k++){
+        const float radius = lights[k]->radius;
+        spheres.push_back({ k, lights[k]->camera.position, radius == MAX_F ? MAX_F : radius + std::abs(shadow_bias) });
+    }
+}
+
 class Raster::PhoneShader: public Raster::Shader{
 public:
     std::vector<Raster::Light*>& lights;
     float shadow_bias;
     bool pcf;
+    bool interpolate_shadow = false; // shadow lookups interpolate per-vertex light space instead of projecting each fragment, see begin_light_space()
 
     PhoneShader(std::vector<Raster::Light*>& lights, const float shadow_bias, const bool pcf): Shader(), lights(lights){
+        this->early_z = true;
         this->do_outline = false;
         this->shadow_bias = shadow_bias;
         this->pcf = pcf;
@@ -151,23 +247,33 @@ public:
         this->line_color = line_color;
     }
 
-    void shade(const Obj::ObjSet* obj,
+    void light_spheres(std::vector<Raster::LightSphere>& spheres) const{
+        ::light_spheres(lights, shadow_bias, spheres);
+    }
+
+    void begin_object(const Obj::ObjSet* obj){
+        begin_light_space(lights, interpolate_shadow ? obj : nullptr, shadow_bias);
+    }
+
+    bool shade(const Obj::ObjSet* obj,
         const Obj::Triangle* triangle,
+        const Raster::ProjectedTriangle& projected,
         const Eigen::Vector3f bc_coord,
         const Raster::Color& fill_color,
         float* z_p,
         float* top_p,
         const bool verbose){
 
-        float z = bc_coord.dot(Eigen::Vector3f(triangle->A->projected_position[2], triangle->B->projected_position[2], triangle->C->projected_position[2]));
+        float z = projected.get_z(bc_coord);
         if(z > 0 || z < *z_p){
-            return;
+            return false;
         }
         *z_p = z;
 
         Raster::Color texture_color = get_texture_color(fill_color, obj, triangle, bc_coord);
-        Raster::Color result_color = light_reach(lights, triangle, fill_color, bc_coord, this->shadow_bias, this->pcf);
+        Raster::Color result_color = light_reach(lights, obj, triangle, projected, fill_color, bc_coord, this->shadow_bias, this->pcf);
         color_assign(result_color, top_p);
+        return true;
     }
 };
 
@@ -176,8 +282,10 @@ public:
     std::vector<Raster::Light*>& lights;
     float shadow_bias;
     bool pcf;
+    bool interpolate_shadow = false; // shadow lookups interpolate per-vertex light space instead of projecting each fragment, see begin_light_space()
 
     DiscreteShader(std::vector<Raster::Light*>& lights, const float shadow_bias, const bool pcf): Shader(), lights(lights){
+        this->early_z = true;
         this->do_outline = false;
         this->shadow_bias = shadow_bias;
         this->pcf = pcf;
@@ -191,22 +299,31 @@ public:
         this->line_color = line_color;
     }
 
-    void shade(const Obj::ObjSet* obj,
+    void light_spheres(std::vector<Raster::LightSphere>& spheres) const{
+        ::light_spheres(lights, shadow_bias, spheres);
+    }
+
+    void begin_object(const Obj::ObjSet* obj){
+        begin_light_space(lights, interpolate_shadow ? obj : nullptr, shadow_bias);
+    }
+
+    bool shade(const Obj::ObjSet* obj,
         const Obj::Triangle* triangle,
+        const Raster::ProjectedTriangle& projected,
         const Eigen::Vector3f bc_coord,
         const Raster::Color& fill_color,
         float* z_p,
         float* top_p,
         const bool verbose){
 
-        float z = bc_coord.dot(Eigen::Vector3f(triangle->A->projected_position[2], triangle->B->projected_position[2], triangle->C->projected_position[2]));
+        float z = projected.get_z(bc_coord);
         if(z > 0 || z < *z_p){
-            return;
+            return false;
         }
         *z_p = z;
 
         Raster::Color texture_color = get_texture_color(fill_color, obj, triangle, bc_coord);
-        Raster::Color result_color = light_reach(lights, triangle, fill_color, bc_coord, this->shadow_bias, this->pcf);
+        Raster::Color result_color = light_reach(lights, obj, triangle, projected, fill_color, bc_coord, this->shadow_bias, this->pcf);
         for(int i = 0;i < (int)result_color.image_color;i++){
             if(result_color.color[i] < 0.3){
                 result_color.color[i] = 0.3;
@@ -216,6 +333,7 @@ public:
             }
         }
         color_assign(result_color * texture_color, top_p);
+        return true;
     }
 };
 
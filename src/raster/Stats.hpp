@@ -0,0 +1,231 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <sstream>
+#include <iomanip>
+#include <cstdint>
+
+#include "../global.hpp"
+
+namespace Raster{
+    struct RenderStats;
+    struct PixelCost;
+    class StatsScope;
+    class Progress;
+
+    /*
+    stats of the render running on this thread, nullptr outside of one
+    lets code below the camera (light_reach) count without threading a pointer through every shader
+    */
+    inline RenderStats*& active_stats(){
+        thread_local RenderStats* stats = nullptr;
+        return stats;
+    }
+
+    /*milliseconds since `t0`, which is moved to now for timing the next stage*/
+    inline double elapsed_ms(std::chrono::steady_clock::time_point& t0){
+        auto t1 = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        t0 = t1;
+        return ms;
+    }
+}
+
+
+/*
+counters and stage times of one render, wall milliseconds
+filled by Camera::paint() and Camera::paint_frame_simple(), reset at their start,
+post-process stages applied afterwards add to `post_ms`
+with multisampling, coverage tests and depth rejects count samples instead of pixels
+*/
+struct Raster::RenderStats{
+    double project_ms = 0;
+    double raster_ms = 0;
+    double lines_ms = 0; // feature line extraction and drawing
+    double resolve_ms = 0; // msaa resolve, return of a tiled layout to rows and Shader::post_shade
+    double post_ms = 0;
+    double bake_ms = 0; // shadow maps, see Rasterizer::render_stats()
+
+    uint64_t triangles_in = 0; // of the meshes painted, after level of detail selection
+    uint64_t triangles_lod_saved = 0; // source triangles replaced by coarser Obj::ObjSet::lods
+    uint64_t triangles_backface = 0; // facing away and paint_back off
+    uint64_t triangles_culled = 0; // behind the camera or outside the viewport
+    uint64_t fragments_tested = 0; // coverage tests over the triangle bounding boxes
+    uint64_t fragments_shaded = 0; // Shader::shade calls
+    uint64_t fragments_written = 0;
+    uint64_t depth_rejects = 0; // covered but behind the depth buffer or the near plane
+    uint64_t early_rejects = 0; // part of depth_rejects decided before the shader ran
+    uint64_t lines_drawn = 0;
+    uint64_t shadow_lookups = 0; // shadow map depths read by light_reach
+
+    inline void reset(){
+        *this = RenderStats();
+    }
+    inline double total_ms() const{
+        return project_ms + raster_ms + lines_ms + resolve_ms + post_ms + bake_ms;
+    }
+
+    RenderStats& operator+=(const RenderStats& other){
+        project_ms += other.project_ms;
+        raster_ms += other.raster_ms;
+        lines_ms += other.lines_ms;
+        resolve_ms += other.resolve_ms;
+        post_ms += other.post_ms;
+        bake_ms += other.bake_ms;
+        triangles_in += other.triangles_in;
+        triangles_lod_saved += other.triangles_lod_saved;
+        triangles_backface += other.triangles_backface;
+        triangles_culled += other.triangles_culled;
+        fragments_tested += other.fragments_tested;
+        fragments_shaded += other.fragments_shaded;
+        fragments_written += other.fragments_written;
+        depth_rejects += other.depth_rejects;
+        early_rejects += other.early_rejects;
+        lines_drawn += other.lines_drawn;
+        shadow_lookups += other.shadow_lookups;
+        return *this;
+    }
+
+    /*one JSON object, keys are the member names*/
+    std::string to_json() const{
+        std::ostringstream json;
+        json << std::fixed << std::setprecision(3) << "{"
+             << "\"project_ms\": " << project_ms
+             << ", \"raster_ms\": " << raster_ms
+             << ", \"lines_ms\": " << lines_ms
+             << ", \"resolve_ms\": " << resolve_ms
+             << ", \"post_ms\": " << post_ms
+             << ", \"bake_ms\": " << bake_ms
+             << ", \"total_ms\": " << total_ms()
+             << ", \"triangles_in\": " << triangles_in
+             << ", \"triangles_lod_saved\": " << triangles_lod_saved
+             << ", \"triangles_backface\": " << triangles_backface
+             << ", \"triangles_culled\": " << triangles_culled
+             << ", \"fragments_tested\": " << fragments_tested
+             << ", \"fragments_shaded\": " << fragments_shaded
+             << ", \"fragments_written\": " << fragments_written
+             << ", \"depth_rejects\": " << depth_rejects
+             << ", \"early_rejects\": " << early_rejects
+             << ", \"lines_drawn\": " << lines_drawn
+             << ", \"shadow_lookups\": " << shadow_lookups
+             << "}";
+        return json.str();
+    }
+};
+
+
+/*
+per-pixel counters of one render, kept in Camera::cost_buff while Camera::track_cost is on
+same units as the RenderStats counters of the same name
+*/
+struct Raster::PixelCost{
+    enum class Metric{
+        TESTED,
+        SHADED,
+        SHADOW_LOOKUPS,
+        LINE_STAMPS
+    };
+    static constexpr Metric metrics[] = { Metric::TESTED, Metric::SHADED, Metric::SHADOW_LOOKUPS, Metric::LINE_STAMPS };
+
+    uint32_t tested = 0;
+    uint32_t shaded = 0;
+    uint32_t shadow_lookups = 0;
+    uint32_t line_stamps = 0; // line pixels plotted, before the depth test
+
+    inline uint32_t get(Metric metric) const{
+        switch(metric){
+        case Metric::TESTED:
+            return tested;
+        case Metric::SHADED:
+            return shaded;
+        case Metric::SHADOW_LOOKUPS:
+            return shadow_lookups;
+        default:
+            return line_stamps;
+        }
+    }
+    static const char* name(Metric metric){
+        switch(metric){
+        case Metric::TESTED:
+            return "tested";
+        case Metric::SHADED:
+            return "shaded";
+        case Metric::SHADOW_LOOKUPS:
+            return "shadow";
+        default:
+            return "lines";
+        }
+    }
+};
+
+
+/*makes `stats` the active_stats() of this thread until the scope ends*/
+class Raster::StatsScope{
+private:
+    StatsScope(const StatsScope& other);
+    StatsScope& operator=(const StatsScope& other);
+
+    RenderStats* previous;
+public:
+    StatsScope(RenderStats& stats): previous(active_stats()){
+        active_stats() = &stats;
+    }
+    ~StatsScope(){
+        active_stats() = previous;
+    }
+};
+
+
+/*
+progress of a long loop, reported at most once per `interval_ms`
+tick() reads the clock only every `check_every` items, so it can sit inside hot loops,
+nothing is reported while `callback` is empty
+*/
+class Raster::Progress{
+public:
+    std::function<void(const std::string& stage, int done, int total)> callback;
+    double interval_ms = 200;
+    int check_every = 64;
+
+private:
+    std::string stage;
+    int total = 0;
+    int next_check = 0;
+    std::chrono::steady_clock::time_point last;
+
+public:
+    /*writes "stage: done/total" over the current console line*/
+    static void console(const std::string& stage, int done, int total){
+        std::cout << stage << ": " << done << "/" << total << (done == total ? "\n" : "\r");
+        std::cout.flush();
+    }
+
+    inline explicit operator bool() const{
+        return (bool)callback;
+    }
+
+    void begin(const std::string& stage, int total){
+        this->stage = stage;
+        this->total = total;
+        this->next_check = check_every;
+        this->last = std::chrono::steady_clock::now();
+    }
+    inline void tick(int done){
+        if(done < next_check || !callback){
+            return;
+        }
+        next_check = done + check_every;
+        auto now = std::chrono::steady_clock::now();
+        if(std::chrono::duration<double, std::milli>(now - last).count() >= interval_ms){
+            last = now;
+            callback(stage, done, total);
+        }
+    }
+    /*always reported, so the last line shows the full count*/
+    void end(){
+        if(callback){
+            callback(stage, total, total);
+        }
+    }
+};
@@ -0,0 +1,166 @@
+#include <iostream>
+#include <iomanip>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <fstream>
+
+#include "global.hpp"
+#include "./scene/Sequence.hpp"
+
+inline std::string json_quote(const std::string& text){
+    std::string quoted = "\"";
+    for(char c : text){
+        if(c == '"' || c == '\\'){
+            quoted += '\\';
+            quoted += c;
+        }
+        else if((unsigned char)c < 0x20){
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+            quoted += escaped;
+        }
+        else{
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+/*
+batch renderer
+    render <scene_file> [--threads n] [--concurrent n] [--quiet] [--stats json_path]
+see Scene::SceneFile for the scene file format
+--stats writes the Raster::RenderStats of every job and sequence
+*/
+int main(int argc, char** argv){
+    std::string scene_path;
+    std::string stats_path;
+    int threads = 0;
+    int concurrent = 0;
+    bool verbose = true;
+    for(int i = 1;i < argc;i++){
+        std::string arg = argv[i];
+        if(arg == "--threads" && i + 1 < argc){
+            threads = std::atoi(argv[++i]);
+        }
+        else if(arg == "--concurrent" && i + 1 < argc){
+            concurrent = std::atoi(argv[++i]);
+        }
+        else if(arg == "--stats" && i + 1 < argc){
+            stats_path = argv[++i];
+        }
+        else if(arg == "--quiet"){
+            verbose = false;
+        }
+        else if(scene_path.empty()){
+            scene_path = arg;
+        }
+        else{
+            std::cerr << "unexpected argument " << arg << std::endl;
+            return 2;
+        }
+    }
+    if(scene_path.empty()){
+        std::cerr << "usage: render <scene_file> [--threads n] [--concurrent n] [--quiet] [--stats json_path]" << std::endl;
+        return 2;
+    }
+
+    try{
+        Scene::SceneFile scene(scene_path);
+        if(threads > 0){
+            scene.threads = threads;
+        }
+        if(scene.threads > 0){
+            thread_count() = scene.threads;
+        }
+        if(concurrent > 0){
+            scene.concurrent = concurrent;
+        }
+        std::cout << std::fixed << std::setprecision(1);
+        auto t0 = std::chrono::steady_clock::now();
+        int failed = 0;
+        int total = scene.jobs.size() + scene.sequences.size();
+        double load_ms = 0;
+        double bake_ms = 0;
+        std::vector<std::string> job_json;
+        std::vector<std::string> sequence_json;
+
+        if(!scene.jobs.empty()){
+            Scene::BatchRunner runner(scene, false);
+            if(verbose){
+                std::cout << "loaded " << scene.models.size() << " model(s) and " << scene.instances.size() << " instance(s) in " << runner.load_ms << " ms, baked " << scene.lights.size() << " light(s) in " << runner.bake_ms << " ms" << std::endl;
+            }
+            load_ms = runner.load_ms;
+            bake_ms = runner.bake_ms;
+            std::vector<Scene::JobResult> results = runner.run(false);
+            for(const Scene::JobResult& result : results){
+                std::ostringstream json;
+                json << std::fixed << std::setprecision(3) << "{\"name\": " << json_quote(result.name)
+                     << ", \"output\": " << json_quote(result.output) << ", \"ok\": " << (result.ok ? "true" : "false")
+                     << ", \"paint_ms\": " << result.paint_ms << ", \"post_ms\": " << result.post_ms << ", \"encode_ms\": " << result.encode_ms
+                     << ", \"stats\": " << result.stats.to_json() << "}";
+                job_json.push_back(json.str());
+                if(!result.ok){
+                    failed++;
+                }
+                if(verbose || !result.ok){
+                    std::cout << std::left << std::setw(24) << result.name << std::right
+                              << " paint " << std::setw(8) << result.paint_ms << " ms"
+                              << "  post " << std::setw(7) << result.post_ms << " ms"
+                              << "  encode " << std::setw(7) << result.encode_ms << " ms  "
+                              << (result.ok ? result.output : "FAILED: " + result.error) << std::endl;
+                }
+            }
+        }
+
+        for(const Scene::SequenceDesc& sequence : scene.sequences){
+            try{
+                Scene::SequenceRenderer renderer(scene, sequence);
+                Scene::SequenceStats stats = renderer.run(false);
+                std::ostringstream json;
+                json << std::fixed << std::setprecision(3) << "{\"name\": " << json_quote(sequence.name)
+                     << ", \"frames\": " << stats.frames << ", \"wall_ms\": " << stats.wall_ms << ", \"fps\": " << stats.fps()
+                     << ", \"stats\": " << stats.render.to_json() << "}";
+                sequence_json.push_back(json.str());
+                if(verbose){
+                    std::cout << std::left << std::setw(24) << sequence.name << std::right
+                              << " " << stats.frames << " frames in " << stats.wall_ms << " ms, " << stats.fps() << " fps"
+                              << "  busy ms: load " << stats.load_ms << ", bake " << stats.bake_ms
+                              << ", paint " << stats.paint_ms << ", encode " << stats.encode_ms << std::endl;
+                }
+            }
+            catch(const std::exception& e){
+                failed++;
+                std::cout << std::left << std::setw(24) << sequence.name << std::right << " FAILED: " << e.what() << std::endl;
+            }
+        }
+
+        if(!stats_path.empty()){
+            std::ofstream file(stats_path);
+            if(!file.is_open()){
+                throw Manga3DException("render: stats file is not opened, " + stats_path);
+            }
+            auto write_list = [&file](const std::vector<std::string>& items){
+                for(int i = 0;i < (int)items.size();i++){
+                    file << (i ? ",\n    " : "\n    ") << items[i];
+                }
+                file << (items.empty() ? "]" : "\n  ]");
+            };
+            file << std::fixed << std::setprecision(3) << "{\n  \"load_ms\": " << load_ms << ",\n  \"bake_ms\": " << bake_ms << ",\n  \"jobs\": [";
+            write_list(job_json);
+            file << ",\n  \"sequences\": [";
+            write_list(sequence_json);
+            file << "\n}\n";
+        }
+
+        if(verbose){
+            double total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+            std::cout << total - failed << "/" << total << " jobs done in " << total_ms << " ms" << std::endl;
+        }
+        return failed ? 1 : 0;
+    }
+    catch(const std::exception& e){
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
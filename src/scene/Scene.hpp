@@ -0,0 +1,1011 @@
+#pragma once
+
+#include <fstream>
+#include <sstream>
+#include <cctype>
+#include <chrono>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+#include "../global.hpp"
+#include "../raster/Rasterizer.hpp"
+#include "../output/Output.hpp"
+
+namespace Scene{
+    struct LightDesc;
+    struct InstanceDesc;
+    struct CameraDesc;
+    struct JobDesc;
+    struct JobResult;
+    struct SequenceDesc;
+    class SceneFile;
+    class BatchRunner;
+
+    enum class ShaderMode{
+        DISCRETE, // Rasterizer::paint_phoneshading
+        PHONG,
+        TEXTURE,
+        OUTLINE,
+        FRAME
+    };
+    enum class AAMode{
+        NONE,
+        SIMPLE,
+        FXAA
+    };
+}
+
+
+struct Scene::LightDesc{
+    Raster::Rasterizer::LightType type;
+    float I;
+    Eigen::Vector3f color;
+    int sm_resolution;
+    float sm_fov;
+    Eigen::Vector3f position;
+    float radius = 0; // see Raster::Rasterizer::add_light()
+};
+
+/*one more placement of a shared mesh, see Raster::Rasterizer::add_instance()*/
+struct Scene::InstanceDesc{
+    std::string obj_path;
+    std::string tex_path;
+    Eigen::Vector3f position = Eigen::Vector3f::Zero();
+    float rotate = 0; // around y, radians
+    float scale = 1;
+
+    inline Eigen::Matrix4f model() const{
+        Eigen::Affine3f model = Eigen::Translation3f(position) * Eigen::AngleAxisf(rotate, Eigen::Vector3f::UnitY()) * Eigen::Scaling(scale);
+        return model.matrix();
+    }
+};
+
+struct Scene::CameraDesc{
+    std::string name;
+    Raster::Camera::Projection projection_type;
+    int w;
+    int h;
+    float fovY;
+    Eigen::Vector3f position;
+    Eigen::Vector3f lookat;
+    float up_t;
+};
+
+/*
+one render, every field except name/camera/output has a default
+colors hold 1 to 4 values, the same layout as the Raster::Color constructors
+*/
+struct Scene::JobDesc{
+    std::string name;
+    std::string camera;
+    std::string output;
+    int line_no;
+
+    ShaderMode shader = ShaderMode::DISCRETE;
+    std::vector<float> bg = { 1, 1, 1 };
+    std::vector<float> fill;
+    std::vector<float> line;
+    int msaa = 1;
+    Raster::Shader::OutlineMode outline_mode = Raster::Shader::OutlineMode::GEOMETRY;
+    AAMode aa = AAMode::NONE;
+    float shadow_bias = 0.05;
+    bool pcf = false;
+    bool interpolate_shadow = false; // see Raster::PhoneShader::interpolate_shadow
+    bool paint_back = false;
+    int thickness = 2;
+    float crease_angle = 1;
+    int crease_thickness = 1;
+    int bits = 8;
+    bool heatmap = false; // per-pixel cost heatmaps next to the output, see Output::write_heatmaps
+    bool front_to_back = false;
+    float lod_pixel_error = 1; // see Raster::Camera::lod_pixel_error, only with a `lod` statement
+    int light_tile = 16; // see Raster::Camera::light_tile
+    int buff_tile = 0; // see Raster::Camera::buff_tile
+    Raster::Camera::ColorFormat color_format = Raster::Camera::ColorFormat::FLOAT; // see Raster::Camera::set_formats()
+    Raster::Camera::DepthFormat depth_format = Raster::Camera::DepthFormat::FLOAT;
+    int band = 0; // image rows painted and streamed at a time, see Raster::Camera::paint_bands(), 0 paints whole images
+    std::optional<Raster::ToneStage::Pattern> tone; // inked with the line color before anti-aliasing
+    int tone_period = 6;
+};
+
+/*
+frames [first, last] of an animation, rendered by Scene::SequenceRenderer
+paths may hold a run of `#`, replaced by the zero padded frame number
+*/
+struct Scene::SequenceDesc{
+    std::string name;
+    std::string camera;
+    std::string output;
+    int first;
+    int last;
+    int line_no;
+
+    std::vector<std::pair<std::string, std::string>> models; // empty uses the scene models
+    Eigen::Vector3f move = Eigen::Vector3f::Zero(); // translation per frame
+    float spin = 0; // rotation per frame around y, radians
+    JobDesc job;
+};
+
+struct Scene::JobResult{
+    std::string name;
+    std::string output;
+    bool ok = false;
+    std::string error;
+    double paint_ms = 0;
+    double post_ms = 0;
+    double encode_ms = 0;
+    Raster::RenderStats stats; // shadow maps are shared by the batch, see BatchRunner::bake_ms
+};
+
+
+namespace Scene{
+    inline Raster::Color make_color(const std::vector<float>& c){
+        switch(c.size()){
+        case 1:
+            return Raster::Color(c[0]);
+        case 2:
+            return Raster::Color(c[0], c[1]);
+        case 3:
+            return Raster::Color(c[0], c[1], c[2]);
+        default:
+            return Raster::Color(c[0], c[1], c[2], c[3]);
+        }
+    }
+    /*same channel layout as `bg`, alpha kept opaque*/
+    inline std::vector<float> uniform_color(const std::vector<float>& bg, float v){
+        std::vector<float> c(bg.size(), v);
+        if(c.size() == 2 || c.size() == 4){
+            c.back() = 1;
+        }
+        return c;
+    }
+
+    /*meshes are loaded once per obj and texture path, however many instances use them*/
+    inline void add_instances(Raster::Rasterizer& rasterizer, const std::vector<InstanceDesc>& instances){
+        for(const InstanceDesc& instance : instances){
+            rasterizer.add_instance(rasterizer.load_mesh(instance.obj_path, instance.tex_path), instance.model());
+        }
+    }
+
+    inline void add_lights(Raster::Rasterizer& rasterizer, const std::vector<LightDesc>& lights){
+        for(const LightDesc& light : lights){
+            rasterizer.add_light(light.type, light.I, Raster::Color(light.color.x(), light.color.y(), light.color.z()), light.sm_resolution, light.sm_fov, light.position, light.radius);
+        }
+    }
+
+    /*outline and tone ink, black in the channel layout of `bg` unless set*/
+    inline Raster::Color line_color(const JobDesc& job){
+        return make_color(job.line.empty() ? uniform_color(job.bg, 0) : job.line);
+    }
+
+    /*camera of `rasterizer` set up for `job`, `h` rows tall*/
+    inline void config_job(Raster::Rasterizer& rasterizer, const CameraDesc& desc, const JobDesc& job, int h){
+        Raster::Color bg_color = make_color(job.bg);
+        Eigen::Vector3f position = desc.position;
+        Eigen::Vector3f lookat = desc.lookat;
+        rasterizer.config_camera(desc.projection_type, bg_color, desc.w, h, desc.fovY, position, lookat, desc.up_t);
+        rasterizer.set_msaa(job.msaa);
+        rasterizer.set_outline_mode(job.outline_mode);
+        rasterizer.set_front_to_back(job.front_to_back);
+        rasterizer.camera.track_cost = job.heatmap;
+        rasterizer.set_lod_pixel_error(job.lod_pixel_error);
+        rasterizer.set_light_tile(job.light_tile);
+        rasterizer.set_buff_tile(job.buff_tile);
+        rasterizer.set_formats(job.color_format, job.depth_format);
+        rasterizer.camera.track_shade = job.tone.has_value();
+    }
+
+    /*paint one job with the camera as configured, lights must already be baked*/
+    inline void paint_configured(Raster::Rasterizer& rasterizer, const JobDesc& job, bool verbose){
+        Raster::Color fill_color = make_color(job.fill.empty() ? uniform_color(job.bg, 1) : job.fill);
+        Raster::Color line_color = Scene::line_color(job);
+        switch(job.shader){
+        case ShaderMode::PHONG:{
+            Raster::PhoneShader shader(rasterizer.lights, job.shadow_bias, job.pcf);
+            shader.interpolate_shadow = job.interpolate_shadow;
+            shader.set_outline(job.thickness, job.crease_angle, job.crease_thickness, line_color);
+            rasterizer.paint_shader(shader, fill_color, job.paint_back, verbose);
+            break;
+        }
+        case ShaderMode::TEXTURE:
+            rasterizer.paint_texture_simple(fill_color, job.paint_back, verbose);
+            break;
+        case ShaderMode::OUTLINE:
+            rasterizer.paint_outline_simple(line_color, fill_color, job.thickness, job.crease_angle, job.crease_thickness, job.paint_back, verbose);
+            break;
+        case ShaderMode::FRAME:
+            rasterizer.paint_frame_simple(line_color, verbose);
+            break;
+        default:{
+            Raster::DiscreteShader shader(rasterizer.lights, job.shadow_bias, job.pcf);
+            shader.interpolate_shadow = job.interpolate_shadow;
+            shader.set_outline(job.thickness, job.crease_angle, job.crease_thickness, line_color);
+            rasterizer.paint_shader(shader, fill_color, job.paint_back, verbose);
+            break;
+        }
+        }
+    }
+
+    /*configure the camera of `rasterizer` and paint one job, lights must already be baked*/
+    inline void paint_job(Raster::Rasterizer& rasterizer, const CameraDesc& desc, const JobDesc& job, bool verbose){
+        config_job(rasterizer, desc, job, desc.h);
+        paint_configured(rasterizer, job, verbose);
+    }
+
+    inline void post_job(Raster::Rasterizer& rasterizer, const JobDesc& job){
+        if(job.tone){
+            rasterizer.tone(job.tone.value(), job.tone_period, line_color(job));
+        }
+        switch(job.aa){
+        case AAMode::SIMPLE:
+            rasterizer.simple_aa();
+            break;
+        case AAMode::FXAA:
+            rasterizer.fxaa();
+            break;
+        default:
+            break;
+        }
+    }
+
+    /*rows around a pixel the screen outline and anti-aliasing of `job` read, the apron of its bands*/
+    inline int post_reach(const JobDesc& job){
+        int reach = 0;
+        const bool outlined = job.shader == ShaderMode::PHONG || job.shader == ShaderMode::DISCRETE || job.shader == ShaderMode::OUTLINE;
+        if(outlined && job.outline_mode == Raster::Shader::OutlineMode::SCREEN){
+            reach += std::max(job.thickness, job.crease_thickness) + 1;
+        }
+        if(job.aa == AAMode::SIMPLE){
+            reach += 1;
+        }
+        else if(job.aa == AAMode::FXAA){
+            reach += (int)std::ceil(Raster::FXAAStage().span_max * 0.5f) + 2;
+        }
+        return reach;
+    }
+
+    /*
+    paints `job` job.band rows at a time and streams every band to its QOI output,
+    the camera buffers never hold more than one band and the rows its post stages read around it
+    */
+    inline void render_bands(Raster::Rasterizer& rasterizer, const CameraDesc& desc, const JobDesc& job, JobResult& result, bool verbose){
+        const int apron = post_reach(job);
+        const int channel = (int)make_color(job.bg).image_color;
+        config_job(rasterizer, desc, job, std::min(job.band + apron, desc.h));
+        Output::QOIEncoder encoder(job.output, desc.w, desc.h, Output::qoi_channel(channel));
+        Raster::RenderStats stats;
+        std::vector<float> band_rows;
+        rasterizer.paint_bands(desc.h, job.band, apron, [&](int top, int y, int rows){
+            auto t0 = std::chrono::steady_clock::now();
+            paint_configured(rasterizer, job, false);
+            auto t1 = std::chrono::steady_clock::now();
+            post_job(rasterizer, job);
+            auto t2 = std::chrono::steady_clock::now();
+            const Raster::Camera& camera = rasterizer.camera;
+            if(camera.top_buff){
+                Output::write_qoi_rows(encoder, camera.top_buff + (size_t)top * camera.w * channel, camera.w, rows, channel);
+            }
+            else{ // compact color with no post stage to expand it
+                band_rows.resize((size_t)rows * camera.w * channel);
+                camera.read_color_rows(top, rows, band_rows.data());
+                Output::write_qoi_rows(encoder, band_rows.data(), camera.w, rows, channel);
+            }
+            result.paint_ms += std::chrono::duration<double, std::milli>(t1 - t0).count();
+            result.post_ms += std::chrono::duration<double, std::milli>(t2 - t1).count();
+            result.encode_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t2).count();
+            stats += rasterizer.render_stats();
+            if(verbose){
+                std::cout << "band " << y << "-" << y + rows << " of " << desc.h << std::endl;
+            }
+        });
+        encoder.finish();
+        result.stats = stats;
+        result.ok = true;
+    }
+}
+
+
+/*
+line based scene description, a word starting with `#` begins a comment, angles are in degrees
+
+    threads <n>
+    concurrent <n>          jobs painted at the same time, 1 runs them back to back
+    model   <obj_path> [tex_path]
+    instance <obj_path> <x> <y> <z> [tex=<path>] [rotate=<degrees>] [scale=<s>]
+                            one more copy of a mesh sharing its geometry, rotate turns around y
+    lod     <levels> [crease_angle]   simplified levels of every model, creases sharper than the angle keep their outline
+    light   point|sun <I> <r> <g> <b> <shadow_map_resolution> <shadow_map_fov> <x> <y> <z> [radius=<r>]
+                            a point light reaches until it fades under 1/256 unless radius is set
+    camera  <name> persp|ortho|fisheye <w> <h> <fovY> <px> <py> <pz> <lx> <ly> <lz> [up_t]
+    job     <name> <camera> <output> [key=value ...]
+    sequence <name> <camera> <output_####.png> <first> <last> [key=value ...]
+
+job keys:
+    shader=discrete|phong|texture|outline|frame
+    bg=, fill=, line=       comma separated color, e.g. bg=1,1,1
+    msaa=1|2|4|8
+    outline=geometry|screen
+    aa=none|simple|fxaa
+    bias=<float> pcf=0|1 back=0|1
+    shadow=project|interpolate
+                            interpolate reads shadow maps at light space interpolated from the vertices, bias applied per vertex
+    thickness=<int> crease_angle=<degrees> crease_thickness=<int>
+    bits=8|16               png only
+    order=file|front        triangle order, front paints nearest clusters first
+    heatmap=0|1             also write <output>.tested.png, .shaded.png, .shadow.png and .lines.png
+    lod_error=<pixels>      coarsest level whose error stays within this many pixels, 0 paints full detail
+    tone=none|dots|lines|crosshatch
+                            screentone in the line color over shaded areas, needs a lit shader
+    tone_period=<pixels>    size of one tone cell
+    light_tile=<pixels>     screen tiles point lights are culled against, 0 evaluates every light per pixel
+    buff_tile=<pixels>      depth and color stored in square blocks while painting, 0 or a power of two from 4 to 64
+    band=<rows>             paint and stream the image this many rows at a time, memory follows the band, .qoi output only
+    color=float|half|8      color storage while painting, 8 matches 8-bit outputs when no aa or tone stage follows
+    depth=32|24|16          depth storage while painting, 24 and 16 bits span the depth of the scene in view
+
+sequence keys, plus every job key:
+    obj=<path_####.obj>     per-frame mesh, repeatable, replaces the scene models and instances
+    tex=<path>              texture of the preceding obj=
+    spin=<degrees>          rotation around y per frame
+    move=<x>,<y>,<z>        translation per frame
+*/
+class Scene::SceneFile{
+public:
+    std::string path;
+    int threads = 0;
+    int concurrent = 1;
+    std::vector<std::pair<std::string, std::string>> models;
+    std::vector<InstanceDesc> instances;
+    int lod_levels = 0;
+    float lod_crease_angle = 1;
+    std::vector<LightDesc> lights;
+    std::vector<CameraDesc> cameras;
+    std::vector<JobDesc> jobs;
+    std::vector<SequenceDesc> sequences;
+
+    SceneFile(){}
+    SceneFile(const std::string& scene_path): path(scene_path){
+        std::ifstream file(scene_path);
+        if(!file.is_open()){
+            throw Manga3DException("Scene: scene file is not opened, " + scene_path);
+        }
+        std::string text;
+        int line_no = 0;
+        while(std::getline(file, text)){
+            line_no++;
+            for(size_t i = 0;i < text.size();i++){ // `#` inside a word is a frame pattern, not a comment
+                if(text[i] == '#' && (i == 0 || std::isspace((unsigned char)text[i - 1]))){
+                    text.erase(i);
+                    break;
+                }
+            }
+            std::istringstream line(text);
+            std::vector<std::string> tokens;
+            std::string token;
+            while(line >> token){
+                tokens.push_back(token);
+            }
+            if(!tokens.empty()){
+                parse_line(tokens, line_no);
+            }
+        }
+        file.close();
+        validate();
+    }
+
+    const CameraDesc* find_camera(const std::string& name) const{
+        for(const CameraDesc& camera : cameras){
+            if(camera.name == name){
+                return &camera;
+            }
+        }
+        return nullptr;
+    }
+
+private:
+    inline Manga3DException error(int line_no, const std::string& message) const{
+        return Manga3DException("Scene: " + path + ":" + std::to_string(line_no) + ": " + message);
+    }
+
+    float to_float(const std::string& s, int line_no) const{
+        try{
+            size_t used = 0;
+            float v = std::stof(s, &used);
+            if(used == s.size()){
+                return v;
+            }
+        }
+        catch(...){}
+        throw error(line_no, "expected a number, got '" + s + "'");
+    }
+    int to_int(const std::string& s, int line_no) const{
+        float v = to_float(s, line_no);
+        if(v != (int)v){
+            throw error(line_no, "expected an integer, got '" + s + "'");
+        }
+        return (int)v;
+    }
+    bool to_bool(const std::string& s, int line_no) const{
+        if(s == "1" || s == "true" || s == "on"){
+            return true;
+        }
+        if(s == "0" || s == "false" || s == "off"){
+            return false;
+        }
+        throw error(line_no, "expected 0/1, got '" + s + "'");
+    }
+    std::vector<float> to_floats(const std::string& s, int line_no) const{
+        std::vector<float> values;
+        std::istringstream in(s);
+        std::string part;
+        while(std::getline(in, part, ',')){
+            values.push_back(to_float(part, line_no));
+        }
+        return values;
+    }
+    std::vector<float> to_color(const std::string& s, int line_no) const{
+        std::vector<float> color = to_floats(s, line_no);
+        if(color.empty() || color.size() > 4){
+            throw error(line_no, "color needs 1 to 4 values, got '" + s + "'");
+        }
+        return color;
+    }
+    Eigen::Vector3f to_vector3(const std::vector<std::string>& tokens, size_t i, int line_no) const{
+        return Eigen::Vector3f(to_float(tokens[i], line_no), to_float(tokens[i + 1], line_no), to_float(tokens[i + 2], line_no));
+    }
+    inline float to_radian(const std::string& s, int line_no) const{
+        return to_float(s, line_no) * PI / 180;
+    }
+
+    void parse_line(const std::vector<std::string>& tokens, int line_no){
+        const std::string& keyword = tokens[0];
+        if(keyword == "threads"){
+            if(tokens.size() != 2){
+                throw error(line_no, "usage: threads <n>");
+            }
+            threads = to_int(tokens[1], line_no);
+        }
+        else if(keyword == "concurrent"){
+            if(tokens.size() != 2){
+                throw error(line_no, "usage: concurrent <n>");
+            }
+            concurrent = to_int(tokens[1], line_no);
+            if(concurrent < 1){
+                throw error(line_no, "concurrent must be at least 1");
+            }
+        }
+        else if(keyword == "model"){
+            if(tokens.size() != 2 && tokens.size() != 3){
+                throw error(line_no, "usage: model <obj_path> [tex_path]");
+            }
+            models.emplace_back(tokens[1], tokens.size() == 3 ? tokens[2] : "");
+        }
+        else if(keyword == "instance"){
+            if(tokens.size() < 5){
+                throw error(line_no, "usage: instance <obj_path> <x> <y> <z> [tex=<path>] [rotate=<degrees>] [scale=<s>]");
+            }
+            InstanceDesc instance;
+            instance.obj_path = tokens[1];
+            instance.position = to_vector3(tokens, 2, line_no);
+            for(size_t i = 5;i < tokens.size();i++){
+                size_t eq = tokens[i].find('=');
+                if(eq == std::string::npos){
+                    throw error(line_no, "expected key=value, got '" + tokens[i] + "'");
+                }
+                const std::string key = tokens[i].substr(0, eq);
+                const std::string value = tokens[i].substr(eq + 1);
+                if(key == "tex"){
+                    instance.tex_path = value;
+                }
+                else if(key == "rotate"){
+                    instance.rotate = to_radian(value, line_no);
+                }
+                else if(key == "scale"){
+                    instance.scale = to_float(value, line_no);
+                    if(instance.scale <= 0){
+                        throw error(line_no, "scale must be positive");
+                    }
+                }
+                else{
+                    throw error(line_no, "unknown instance option '" + key + "'");
+                }
+            }
+            instances.push_back(instance);
+        }
+        else if(keyword == "lod"){
+            if(tokens.size() != 2 && tokens.size() != 3){
+                throw error(line_no, "usage: lod <levels> [crease_angle]");
+            }
+            lod_levels = to_int(tokens[1], line_no);
+            if(lod_levels < 0){
+                throw error(line_no, "lod levels must not be negative");
+            }
+            if(tokens.size() == 3){
+                lod_crease_angle = to_radian(tokens[2], line_no);
+            }
+        }
+        else if(keyword == "light"){
+            if(tokens.size() != 11 && tokens.size() != 12){
+                throw error(line_no, "usage: light point|sun <I> <r> <g> <b> <resolution> <fov> <x> <y> <z> [radius=<r>]");
+            }
+            LightDesc light;
+            if(tokens[1] == "point"){
+                light.type = Raster::Rasterizer::LightType::POINTLIGHT;
+            }
+            else if(tokens[1] == "sun"){
+                light.type = Raster::Rasterizer::LightType::SUNLIGHT;
+            }
+            else{
+                throw error(line_no, "unknown light type '" + tokens[1] + "'");
+            }
+            light.I = to_float(tokens[2], line_no);
+            light.color = to_vector3(tokens, 3, line_no);
+            light.sm_resolution = to_int(tokens[6], line_no);
+            light.sm_fov = to_radian(tokens[7], line_no);
+            light.position = to_vector3(tokens, 8, line_no);
+            if(tokens.size() == 12){
+                if(tokens[11].compare(0, 7, "radius=") != 0){
+                    throw error(line_no, "expected radius=<r>, got '" + tokens[11] + "'");
+                }
+                light.radius = to_float(tokens[11].substr(7), line_no);
+                if(light.radius <= 0){
+                    throw error(line_no, "radius must be positive");
+                }
+            }
+            lights.push_back(light);
+        }
+        else if(keyword == "camera"){
+            if(tokens.size() != 12 && tokens.size() != 13){
+                throw error(line_no, "usage: camera <name> persp|ortho|fisheye <w> <h> <fovY> <px> <py> <pz> <lx> <ly> <lz> [up_t]");
+            }
+            CameraDesc camera;
+            camera.name = tokens[1];
+            if(find_camera(camera.name)){
+                throw error(line_no, "camera '" + camera.name + "' defined twice");
+            }
+            if(tokens[2] == "persp"){
+                camera.projection_type = Raster::Camera::Projection::PERSP;
+            }
+            else if(tokens[2] == "ortho"){
+                camera.projection_type = Raster::Camera::Projection::ORTHO;
+            }
+            else if(tokens[2] == "fisheye"){
+                camera.projection_type = Raster::Camera::Projection::FISHEYE;
+            }
+            else{
+                throw error(line_no, "unknown projection '" + tokens[2] + "'");
+            }
+            camera.w = to_int(tokens[3], line_no);
+            camera.h = to_int(tokens[4], line_no);
+            if(camera.w <= 0 || camera.h <= 0){
+                throw error(line_no, "camera size must be positive");
+            }
+            camera.fovY = to_radian(tokens[5], line_no);
+            camera.position = to_vector3(tokens, 6, line_no);
+            camera.lookat = to_vector3(tokens, 9, line_no);
+            camera.up_t = tokens.size() == 13 ? to_radian(tokens[12], line_no) : 0;
+            cameras.push_back(camera);
+        }
+        else if(keyword == "job"){
+            if(tokens.size() < 4){
+                throw error(line_no, "usage: job <name> <camera> <output> [key=value ...]");
+            }
+            JobDesc job;
+            job.name = tokens[1];
+            job.camera = tokens[2];
+            job.output = tokens[3];
+            job.line_no = line_no;
+            for(size_t i = 4;i < tokens.size();i++){
+                size_t eq = tokens[i].find('=');
+                if(eq == std::string::npos){
+                    throw error(line_no, "expected key=value, got '" + tokens[i] + "'");
+                }
+                parse_option(job, tokens[i].substr(0, eq), tokens[i].substr(eq + 1), line_no);
+            }
+            jobs.push_back(job);
+        }
+        else if(keyword == "sequence"){
+            if(tokens.size() < 6){
+                throw error(line_no, "usage: sequence <name> <camera> <output_pattern> <first> <last> [key=value ...]");
+            }
+            SequenceDesc sequence;
+            sequence.name = tokens[1];
+            sequence.camera = tokens[2];
+            sequence.output = tokens[3];
+            sequence.first = to_int(tokens[4], line_no);
+            sequence.last = to_int(tokens[5], line_no);
+            sequence.line_no = line_no;
+            sequence.job.name = sequence.name;
+            sequence.job.camera = sequence.camera;
+            sequence.job.output = sequence.output;
+            sequence.job.line_no = line_no;
+            if(sequence.last < sequence.first){
+                throw error(line_no, "last frame before first frame");
+            }
+            for(size_t i = 6;i < tokens.size();i++){
+                size_t eq = tokens[i].find('=');
+                if(eq == std::string::npos){
+                    throw error(line_no, "expected key=value, got '" + tokens[i] + "'");
+                }
+                const std::string key = tokens[i].substr(0, eq);
+                const std::string value = tokens[i].substr(eq + 1);
+                if(key == "obj"){
+                    sequence.models.emplace_back(value, "");
+                }
+                else if(key == "tex"){
+                    if(sequence.models.empty()){
+                        throw error(line_no, "tex= needs a preceding obj=");
+                    }
+                    sequence.models.back().second = value;
+                }
+                else if(key == "spin"){
+                    sequence.spin = to_radian(value, line_no);
+                }
+                else if(key == "move"){
+                    std::vector<float> move = to_floats(value, line_no);
+                    if(move.size() != 3){
+                        throw error(line_no, "move needs 3 values, got '" + value + "'");
+                    }
+                    sequence.move = Eigen::Vector3f(move[0], move[1], move[2]);
+                }
+                else{
+                    parse_option(sequence.job, key, value, line_no);
+                }
+            }
+            sequences.push_back(sequence);
+        }
+        else{
+            throw error(line_no, "unknown statement '" + keyword + "'");
+        }
+    }
+
+    void parse_option(JobDesc& job, const std::string& key, const std::string& value, int line_no){
+        if(key == "shader"){
+            if(value == "discrete"){
+                job.shader = ShaderMode::DISCRETE;
+            }
+            else if(value == "phong"){
+                job.shader = ShaderMode::PHONG;
+            }
+            else if(value == "texture"){
+                job.shader = ShaderMode::TEXTURE;
+            }
+            else if(value == "outline"){
+                job.shader = ShaderMode::OUTLINE;
+            }
+            else if(value == "frame"){
+                job.shader = ShaderMode::FRAME;
+            }
+            else{
+                throw error(line_no, "unknown shader '" + value + "'");
+            }
+        }
+        else if(key == "bg"){
+            job.bg = to_color(value, line_no);
+        }
+        else if(key == "fill"){
+            job.fill = to_color(value, line_no);
+        }
+        else if(key == "line"){
+            job.line = to_color(value, line_no);
+        }
+        else if(key == "msaa"){
+            job.msaa = to_int(value, line_no);
+            if(job.msaa != 1 && job.msaa != 2 && job.msaa != 4 && job.msaa != 8){
+                throw error(line_no, "msaa must be 1, 2, 4 or 8");
+            }
+        }
+        else if(key == "outline"){
+            if(value == "geometry"){
+                job.outline_mode = Raster::Shader::OutlineMode::GEOMETRY;
+            }
+            else if(value == "screen"){
+                job.outline_mode = Raster::Shader::OutlineMode::SCREEN;
+            }
+            else{
+                throw error(line_no, "unknown outline mode '" + value + "'");
+            }
+        }
+        else if(key == "aa"){
+            if(value == "none"){
+                job.aa = AAMode::NONE;
+            }
+            else if(value == "simple"){
+                job.aa = AAMode::SIMPLE;
+            }
+            else if(value == "fxaa"){
+                job.aa = AAMode::FXAA;
+            }
+            else{
+                throw error(line_no, "unknown aa '" + value + "'");
+            }
+        }
+        else if(key == "bias"){
+            job.shadow_bias = to_float(value, line_no);
+        }
+        else if(key == "pcf"){
+            job.pcf = to_bool(value, line_no);
+        }
+        else if(key == "shadow"){
+            if(value == "project"){
+                job.interpolate_shadow = false;
+            }
+            else if(value == "interpolate"){
+                job.interpolate_shadow = true;
+            }
+            else{
+                throw error(line_no, "unknown shadow lookup '" + value + "'");
+            }
+        }
+        else if(key == "back"){
+            job.paint_back = to_bool(value, line_no);
+        }
+        else if(key == "thickness"){
+            job.thickness = to_int(value, line_no);
+        }
+        else if(key == "crease_angle"){
+            job.crease_angle = to_radian(value, line_no);
+        }
+        else if(key == "crease_thickness"){
+            job.crease_thickness = to_int(value, line_no);
+        }
+        else if(key == "order"){
+            if(value == "file"){
+                job.front_to_back = false;
+            }
+            else if(value == "front"){
+                job.front_to_back = true;
+            }
+            else{
+                throw error(line_no, "unknown order '" + value + "'");
+            }
+        }
+        else if(key == "heatmap"){
+            job.heatmap = to_bool(value, line_no);
+        }
+        else if(key == "tone"){
+            if(value == "none"){
+                job.tone.reset();
+            }
+            else if(value == "dots"){
+                job.tone = Raster::ToneStage::Pattern::DOTS;
+            }
+            else if(value == "lines"){
+                job.tone = Raster::ToneStage::Pattern::LINES;
+            }
+            else if(value == "crosshatch"){
+                job.tone = Raster::ToneStage::Pattern::CROSSHATCH;
+            }
+            else{
+                throw error(line_no, "unknown tone '" + value + "'");
+            }
+        }
+        else if(key == "tone_period"){
+            job.tone_period = to_int(value, line_no);
+            if(job.tone_period < 2){
+                throw error(line_no, "tone_period must be at least 2");
+            }
+        }
+        else if(key == "light_tile"){
+            job.light_tile = to_int(value, line_no);
+            if(job.light_tile < 0){
+                throw error(line_no, "light_tile must not be negative");
+            }
+        }
+        else if(key == "band"){
+            job.band = to_int(value, line_no);
+            if(job.band < 0){
+                throw error(line_no, "band must not be negative");
+            }
+        }
+        else if(key == "color"){
+            if(value == "float"){
+                job.color_format = Raster::Camera::ColorFormat::FLOAT;
+            }
+            else if(value == "half"){
+                job.color_format = Raster::Camera::ColorFormat::HALF;
+            }
+            else if(value == "8"){
+                job.color_format = Raster::Camera::ColorFormat::UNORM8;
+            }
+            else{
+                throw error(line_no, "color must be float, half or 8");
+            }
+        }
+        else if(key == "depth"){
+            if(value == "32"){
+                job.depth_format = Raster::Camera::DepthFormat::FLOAT;
+            }
+            else if(value == "24"){
+                job.depth_format = Raster::Camera::DepthFormat::UNORM24;
+            }
+            else if(value == "16"){
+                job.depth_format = Raster::Camera::DepthFormat::UNORM16;
+            }
+            else{
+                throw error(line_no, "depth must be 32, 24 or 16");
+            }
+        }
+        else if(key == "buff_tile"){
+            job.buff_tile = to_int(value, line_no);
+            if(job.buff_tile != 0 && (job.buff_tile < 4 || job.buff_tile > 64 || (job.buff_tile & (job.buff_tile - 1)))){
+                throw error(line_no, "buff_tile must be 0 or a power of two from 4 to 64");
+            }
+        }
+        else if(key == "lod_error"){
+            job.lod_pixel_error = to_float(value, line_no);
+            if(job.lod_pixel_error < 0){
+                throw error(line_no, "lod_error must not be negative");
+            }
+        }
+        else if(key == "bits"){
+            job.bits = to_int(value, line_no);
+            if(job.bits != 8 && job.bits != 16){
+                throw error(line_no, "bits must be 8 or 16");
+            }
+        }
+        else{
+            throw error(line_no, "unknown job option '" + key + "'");
+        }
+    }
+
+    void validate() const{
+        if(models.empty() && instances.empty() && !jobs.empty()){
+            throw Manga3DException("Scene: " + path + ": no model");
+        }
+        std::vector<JobDesc> all_jobs = jobs;
+        for(const SequenceDesc& sequence : sequences){
+            if(models.empty() && instances.empty() && sequence.models.empty()){
+                throw error(sequence.line_no, "sequence '" + sequence.name + "' has no model");
+            }
+            all_jobs.push_back(sequence.job);
+        }
+        for(const JobDesc& job : all_jobs){
+            if(!find_camera(job.camera)){
+                throw error(job.line_no, "job '" + job.name + "' uses unknown camera '" + job.camera + "'");
+            }
+            if(!job.fill.empty() && job.fill.size() != job.bg.size()){
+                throw error(job.line_no, "fill and bg need the same number of channels");
+            }
+            if(!job.line.empty() && job.line.size() != job.bg.size()){
+                throw error(job.line_no, "line and bg need the same number of channels");
+            }
+        }
+        for(const JobDesc& job : jobs){
+            if(job.band > 0 && Output::format_from_path(job.output) != Output::Format::QOI){
+                throw error(job.line_no, "band needs a .qoi output, the other formats are encoded from whole images");
+            }
+            if(job.band > 0 && job.heatmap){
+                throw error(job.line_no, "band and heatmap cannot be combined");
+            }
+        }
+        for(const SequenceDesc& sequence : sequences){
+            if(sequence.job.band > 0){
+                throw error(sequence.line_no, "band is only supported by jobs");
+            }
+        }
+    }
+};
+
+
+/*
+renders every job of a SceneFile from one loaded Raster::Rasterizer
+models are loaded and shadow maps baked once, jobs only reconfigure a camera
+`SceneFile::concurrent` workers take jobs in order, each paints through its own Rasterizer view,
+so consecutive jobs of a worker reuse the projection when the camera did not change
+every image is handed to an Output::AsyncWriter, encoding overlaps the next paint,
+banded jobs stream their bands to the encoder themselves
+a failing job is reported in its JobResult and does not stop the batch
+*/
+class Scene::BatchRunner{
+public:
+    const SceneFile& scene;
+    Raster::Rasterizer rasterizer;
+    double load_ms;
+    double bake_ms;
+
+    BatchRunner(const SceneFile& scene, bool verbose = false): scene(scene), load_ms(0), bake_ms(0){
+        if(scene.threads > 0){
+            thread_count() = scene.threads;
+        }
+        auto t0 = std::chrono::steady_clock::now();
+        for(const auto& model : scene.models){
+            rasterizer.load_obj(model.first, model.second);
+        }
+        add_instances(rasterizer, scene.instances);
+        if(scene.lod_levels > 0){
+            rasterizer.build_lods(scene.lod_levels, scene.lod_crease_angle);
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        add_lights(rasterizer, scene.lights);
+        rasterizer.shadow_bake(verbose);
+        auto t2 = std::chrono::steady_clock::now();
+        load_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        bake_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    }
+
+    std::vector<JobResult> run(bool verbose = false){
+        const int n = scene.jobs.size();
+        std::vector<JobResult> results(n);
+        const int workers = scene.concurrent < n ? scene.concurrent : (n > 0 ? n : 1);
+        Output::AsyncWriter writer(2, 2 * workers);
+        std::atomic<int> next(0);
+        std::mutex print_mutex;
+
+        auto work = [&](){
+            Raster::Rasterizer view(this->rasterizer, Raster::Color(0, 0)); // config_job() sets each job's background
+            for(int i = next++;i < n;i = next++){
+                const JobDesc& job = scene.jobs[i];
+                JobResult& result = results[i];
+                result.name = job.name;
+                result.output = job.output;
+                try{
+                    if(job.band > 0){ // streamed to the encoder on this worker, the writer only takes whole images
+                        render_bands(view, *scene.find_camera(job.camera), job, result, verbose && workers == 1);
+                    }
+                    else{
+                        auto t0 = std::chrono::steady_clock::now();
+                        paint_job(view, *scene.find_camera(job.camera), job, verbose && workers == 1);
+                        auto t1 = std::chrono::steady_clock::now();
+                        post_job(view, job);
+                        auto t2 = std::chrono::steady_clock::now();
+                        result.paint_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+                        result.post_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+                        result.stats = view.render_stats();
+
+                        std::shared_ptr<Output::Image> image = std::make_shared<Output::Image>(view.camera);
+                        const std::string path = job.output;
+                        const int bits = job.bits;
+                        std::shared_ptr<std::vector<Output::Image>> heatmaps = std::make_shared<std::vector<Output::Image>>();
+                        if(job.heatmap){
+                            for(Raster::PixelCost::Metric metric : Raster::PixelCost::metrics){
+                                heatmaps->push_back(Output::cost_heatmap(view.camera, metric));
+                            }
+                        }
+                        writer.submit([image, heatmaps, path, bits, &result](){
+                            auto e0 = std::chrono::steady_clock::now();
+                            try{
+                                Output::write(*image, path, bits);
+                                for(int m = 0;m < (int)heatmaps->size();m++){
+                                    Output::write_png((*heatmaps)[m], Output::heatmap_path(path, Raster::PixelCost::metrics[m]));
+                                }
+                                result.ok = true;
+                            }
+                            catch(const std::exception& e){
+                                result.error = e.what();
+                            }
+                            result.encode_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - e0).count();
+                        });
+                    }
+                }
+                catch(const std::exception& e){
+                    result.error = e.what();
+                }
+                if(verbose){
+                    std::lock_guard<std::mutex> lock(print_mutex);
+                    std::cout << "job " << job.name << ": " << (result.error.empty() ? "painted" : "failed, " + result.error) << std::endl;
+                }
+            }
+        };
+        if(workers == 1){
+            work();
+        }
+        else{
+            const int share = thread_count() / workers > 1 ? thread_count() / workers : 1;
+            std::vector<std::thread> threads;
+            for(int t = 0;t < workers;t++){
+                threads.emplace_back([&work, share](){
+                    thread_share() = share;
+                    work();
+                });
+            }
+            for(std::thread& thread : threads){
+                thread.join();
+            }
+        }
+        writer.wait();
+        return results;
+    }
+};
@@ -0,0 +1,322 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+#include "Scene.hpp"
+
+namespace Scene{
+    template<typename T>
+    class BoundedQueue;
+    struct SequenceStats;
+    class SequenceRenderer;
+
+    /*replace the last run of `#` in `pattern` with `frame`, zero padded to the run length*/
+    inline std::string frame_path(const std::string& pattern, int frame){
+        size_t end = pattern.find_last_of('#');
+        if(end == std::string::npos){
+            return pattern;
+        }
+        size_t begin = end;
+        while(begin > 0 && pattern[begin - 1] == '#'){
+            begin--;
+        }
+        std::string number = std::to_string(frame < 0 ? -frame : frame);
+        if(number.size() < end - begin + 1){
+            number.insert(0, end - begin + 1 - number.size(), '0');
+        }
+        if(frame < 0){
+            number.insert(0, 1, '-');
+        }
+        return pattern.substr(0, begin) + number + pattern.substr(end + 1);
+    }
+}
+
+
+/*
+blocking FIFO between two pipeline stages
+push() waits while `capacity` items are queued, pop() waits while empty
+after close() pushes fail and pops drain what is left, cancel() also drops the queued items
+*/
+template<typename T>
+class Scene::BoundedQueue{
+private:
+    BoundedQueue(const BoundedQueue& other);
+    BoundedQueue& operator=(const BoundedQueue& other);
+
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    size_t capacity;
+    bool closed;
+
+public:
+    BoundedQueue(size_t capacity): capacity(capacity > 0 ? capacity : 1), closed(false){}
+
+    bool push(T item){
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            not_full.wait(lock, [this](){ return closed || items.size() < capacity; });
+            if(closed){
+                return false;
+            }
+            items.push_back(std::move(item));
+        }
+        not_empty.notify_one();
+        return true;
+    }
+    bool pop(T& item){
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            not_empty.wait(lock, [this](){ return closed || !items.empty(); });
+            if(items.empty()){
+                return false;
+            }
+            item = std::move(items.front());
+            items.pop_front();
+        }
+        not_full.notify_one();
+        return true;
+    }
+    void close(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+    void cancel(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+            items.clear();
+        }
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+};
+
+
+/*busy time is summed per stage, the pipeline keeps up with the slowest one*/
+struct Scene::SequenceStats{
+    int frames = 0;
+    double wall_ms = 0;
+    double load_ms = 0;
+    double bake_ms = 0;
+    double paint_ms = 0;
+    double encode_ms = 0;
+    Raster::RenderStats render; // summed over frames
+
+    inline double fps() const{
+        return wall_ms > 0 ? frames * 1000.0 / wall_ms : 0;
+    }
+};
+
+
+/*
+renders a Scene::SequenceDesc as a pipeline, one thread per stage joined by bounded queues
+
+    load -> bake -> paint -> encode
+
+while frame N is painted, N+1 bakes its shadow maps, N+2 loads and N-1 is encoded
+every frame in flight owns its Raster::Rasterizer, so stages never share mutable state,
+textures are still decoded once through Tex::TextureRegistry
+without per-frame model paths the scene meshes and their levels are loaded once,
+frames only hold instances of them placed by the step transform
+the first failing stage cancels the others and its exception is rethrown by run()
+*/
+class Scene::SequenceRenderer{
+public:
+    const SceneFile& scene;
+    const SequenceDesc& sequence;
+    size_t queue_depth;
+    int encode_threads;
+
+    SequenceRenderer(const SceneFile& scene, const SequenceDesc& sequence, size_t queue_depth = 2, int encode_threads = 2):
+        scene(scene), sequence(sequence), queue_depth(queue_depth), encode_threads(encode_threads > 0 ? encode_threads : 1){
+        if(!scene.find_camera(sequence.camera)){
+            throw Manga3DException("Scene::SequenceRenderer(): unknown camera '" + sequence.camera + "'");
+        }
+    }
+
+    SequenceStats run(bool verbose = false){
+        struct Frame{
+            int index;
+            std::unique_ptr<Raster::Rasterizer> rasterizer;
+            std::unique_ptr<Output::Image> image;
+            std::vector<Output::Image> heatmaps; // one per Raster::PixelCost::metrics when the job asks for them
+        };
+        BoundedQueue<Frame> loaded(queue_depth);
+        BoundedQueue<Frame> baked(queue_depth);
+        BoundedQueue<Frame> painted(queue_depth);
+        const CameraDesc& camera = *scene.find_camera(sequence.camera);
+
+        SequenceStats stats;
+        std::mutex stats_mutex;
+        std::exception_ptr error;
+        auto fail = [&](){
+            {
+                std::lock_guard<std::mutex> lock(stats_mutex);
+                if(!error){
+                    error = std::current_exception();
+                }
+            }
+            loaded.cancel();
+            baked.cancel();
+            painted.cancel();
+        };
+        auto elapsed = [](std::chrono::steady_clock::time_point t0){
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        };
+
+        auto t_begin = std::chrono::steady_clock::now();
+        std::unique_ptr<Raster::Rasterizer> assets; // outlives the stages, their instances read its meshes
+        if(sequence.models.empty()){
+            assets = load_assets();
+            stats.load_ms += elapsed(t_begin);
+        }
+        std::vector<std::thread> stages;
+        stages.emplace_back([&](){
+            try{
+                for(int f = sequence.first;f <= sequence.last;f++){
+                    auto t0 = std::chrono::steady_clock::now();
+                    Frame frame{ f, assets ? place(*assets, f) : load(f), nullptr, {} };
+                    stats.load_ms += elapsed(t0);
+                    if(!loaded.push(std::move(frame))){
+                        break;
+                    }
+                }
+                loaded.close();
+            }
+            catch(...){
+                fail();
+            }
+        });
+        stages.emplace_back([&](){
+            try{
+                Frame frame;
+                while(loaded.pop(frame)){
+                    auto t0 = std::chrono::steady_clock::now();
+                    add_lights(*frame.rasterizer, scene.lights);
+                    frame.rasterizer->shadow_bake(false);
+                    stats.bake_ms += elapsed(t0);
+                    if(!baked.push(std::move(frame))){
+                        break;
+                    }
+                }
+                baked.close();
+            }
+            catch(...){
+                fail();
+            }
+        });
+        stages.emplace_back([&](){
+            try{
+                Frame frame;
+                while(baked.pop(frame)){
+                    auto t0 = std::chrono::steady_clock::now();
+                    paint_job(*frame.rasterizer, camera, sequence.job, false);
+                    post_job(*frame.rasterizer, sequence.job);
+                    stats.render += frame.rasterizer->render_stats();
+                    frame.image.reset(new Output::Image(frame.rasterizer->camera));
+                    if(sequence.job.heatmap){
+                        for(Raster::PixelCost::Metric metric : Raster::PixelCost::metrics){
+                            frame.heatmaps.push_back(Output::cost_heatmap(frame.rasterizer->camera, metric));
+                        }
+                    }
+                    frame.rasterizer.reset();
+                    stats.paint_ms += elapsed(t0);
+                    if(!painted.push(std::move(frame))){
+                        break;
+                    }
+                }
+                painted.close();
+            }
+            catch(...){
+                fail();
+            }
+        });
+        for(int t = 0;t < encode_threads;t++){
+            stages.emplace_back([&](){
+                try{
+                    Frame frame;
+                    while(painted.pop(frame)){
+                        auto t0 = std::chrono::steady_clock::now();
+                        const std::string path = frame_path(sequence.output, frame.index);
+                        Output::write(*frame.image, path, sequence.job.bits);
+                        frame.image.reset();
+                        for(int m = 0;m < (int)frame.heatmaps.size();m++){
+                            Output::write_png(frame.heatmaps[m], Output::heatmap_path(path, Raster::PixelCost::metrics[m]));
+                        }
+                        frame.heatmaps.clear();
+                        std::lock_guard<std::mutex> lock(stats_mutex);
+                        stats.encode_ms += elapsed(t0);
+                        stats.frames++;
+                        if(verbose){
+                            std::cout << "frame " << frame.index << " -> " << path << std::endl;
+                        }
+                    }
+                }
+                catch(...){
+                    fail();
+                }
+            });
+        }
+        for(std::thread& stage : stages){
+            stage.join();
+        }
+        stats.wall_ms = elapsed(t_begin);
+        if(error){
+            std::rethrow_exception(error);
+        }
+        return stats;
+    }
+
+private:
+    /*`spin` and `move` applied `f - first` times*/
+    Eigen::Matrix4f step_model(int f) const{
+        const int step = f - sequence.first;
+        return (Eigen::Translation3f(sequence.move * step) * Eigen::AngleAxisf(sequence.spin * step, Eigen::Vector3f::UnitY())).matrix();
+    }
+    /*scene models and instances with their levels, shared by every frame's place()*/
+    std::unique_ptr<Raster::Rasterizer> load_assets() const{
+        std::unique_ptr<Raster::Rasterizer> rasterizer(new Raster::Rasterizer());
+        for(const auto& model : scene.models){
+            rasterizer->load_obj(model.first, model.second);
+        }
+        add_instances(*rasterizer, scene.instances);
+        if(scene.lod_levels > 0){
+            rasterizer->build_lods(scene.lod_levels, scene.lod_crease_angle);
+        }
+        return rasterizer;
+    }
+    /*frame `f` as instances of the objects of `assets`, only their matrices are stored*/
+    std::unique_ptr<Raster::Rasterizer> place(const Raster::Rasterizer& assets, int f) const{
+        std::unique_ptr<Raster::Rasterizer> rasterizer(new Raster::Rasterizer());
+        const Eigen::Matrix4f model = step_model(f);
+        for(const Obj::ObjSet* obj : assets.obj_set){
+            rasterizer->add_instance(obj, model);
+        }
+        return rasterizer;
+    }
+    /*meshes of frame `f` read from its per-frame paths and moved by `spin` and `move`*/
+    std::unique_ptr<Raster::Rasterizer> load(int f) const{
+        std::unique_ptr<Raster::Rasterizer> rasterizer(new Raster::Rasterizer());
+        for(const auto& model : sequence.models){
+            rasterizer->load_obj(frame_path(model.first, f), model.second);
+        }
+        if(scene.lod_levels > 0){
+            rasterizer->build_lods(scene.lod_levels, scene.lod_crease_angle);
+        }
+        if(f != sequence.first && (sequence.spin != 0 || !sequence.move.isZero())){
+            const Eigen::Matrix4f model = step_model(f);
+            for(Obj::ObjSet* obj : rasterizer->obj_set){
+                obj->transform(model);
+            }
+        }
+        return rasterizer;
+    }
+};